@@ -43,6 +43,54 @@ int main()
 	printf("bug: signature verifies with wrong public key\n");
     }
 
+    //verify a few signatures at once
+    {
+	byte_string_t sigs[3], messages[3], pubkeys[3];
+	int valid[3];
+	int i;
+
+	byte_string_set(messages[0], "Hello, World");
+	byte_string_set(messages[1], "Goodbye, World");
+	byte_string_set(messages[2], "Hello again");
+	for (i=0; i<3; i++) {
+	    BLS_sign(sigs[i], messages[i], i == 1 ? priv2 : priv, params);
+	    byte_string_copy(pubkeys[i], i == 1 ? pub2 : pub);
+	}
+
+	if (BLS_verify_batch(valid, sigs, messages, pubkeys, 3, params)) {
+	    printf("batch verifies\n");
+	} else {
+	    printf("bug: batch does not verify\n");
+	}
+
+	byte_string_clear(pubkeys[2]);
+	byte_string_copy(pubkeys[2], pub2);
+	if (BLS_verify_batch(valid, sigs, messages, pubkeys, 3, params)) {
+	    printf("bug: batch verifies with wrong public key\n");
+	}
+	printf("1 1 0 = %d %d %d\n", valid[0], valid[1], valid[2]);
+
+	//or combine them into one signature
+	byte_string_clear(pubkeys[2]);
+	byte_string_copy(pubkeys[2], pub);
+	byte_string_clear(sig);
+	BLS_aggregate(sig, sigs, 3, params);
+	if (BLS_aggregate_verify(sig, messages, pubkeys, 3, params)) {
+	    printf("aggregate signature verifies\n");
+	} else {
+	    printf("bug: aggregate signature does not verify\n");
+	}
+	if (BLS_aggregate_verify(sig, messages, pubkeys, 2, params)) {
+	    printf("bug: aggregate signature verifies with missing message\n");
+	}
+
+	for (i=0; i<3; i++) {
+	    byte_string_clear(sigs[i]);
+	    byte_string_clear(messages[i]);
+	    byte_string_clear(pubkeys[i]);
+	}
+    }
+
     params_clear(params);
 
     IBE_clear();
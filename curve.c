@@ -11,6 +11,7 @@ See LICENSE for license
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "curve.h"
 #include "benchmark.h"
 #include "mm.h"
@@ -21,6 +22,14 @@ enum {
     //constants for sliding window algorithms
     windowsize = 5,
     windowsizepower = 15,	    //this is 2^(windowsize-1) - 1
+    //w-NAF width in Straus' method
+    multiwindowsize = 5,
+    //point_multi_mul switches to Pippenger's method at this many points
+    pippenger_min = 128,
+    //point_mul_array works on this many points at a time
+    point_mul_chunk_size = 64,
+    //scalars up to this many bits are recoded on the stack
+    point_mul_stackbits = 1024
 };
 
 void point_init(point_ptr P)
@@ -82,7 +91,84 @@ int point_equal(point_t P, point_t Q)
     return fp2_equal(P->x, Q->x) && fp2_equal(P->y, Q->y);
 }
 
-void curve_init(curve_t curve, mpz_t prime, mpz_t qprime)
+static int point_mul_schedule(int *step, mpz_t n)
+//recode n > 0 for the signed sliding-window method:
+//step[0] is the odd digit to start from, then each pair
+//step[2k+1], step[2k+2] means double that many times and add that
+//odd digit (0 for none)
+//returns the number of entries used, at most 2 log n + 3
+//(0 if n <= 0)
+{
+    //compute NAF form (see Blake, Seroussi & Smart IV.2.4)
+    int i, j, k, l;
+    int m = mpz_sizeinbase(n, 2);
+    int sbuf[point_mul_stackbits + 1];
+    int *s;
+    int c0 = 0, c1;
+    int count = 0;
+    int dbl;
+
+    if (mpz_sgn(n) <= 0 || m < 1) return 0;
+    s = m <= point_mul_stackbits ? sbuf : (int *) malloc(sizeof(int) * (m+1));
+
+    for (j=0; j<=m; j++) {
+	c1 = (mpz_tstbit(n, j) + mpz_tstbit(n, j+1) + c0) >> 1;
+	s[j] = mpz_tstbit(n, j) + c0 - 2 * c1;
+	c0 = c1;
+    }
+
+    //first bit might not be used after NAF conversion
+    if (!s[m]) m--;
+
+    l = m - windowsize + 1;
+    if (l < 0) l = 0;
+    for (; l<m; l++) {
+	if (s[l]) break;
+    }
+    j = s[l];
+    i = 1;
+    for (k=l+1; k<=m; k++) {
+	i = i << 1;
+	j += s[k] * i;
+    }
+    step[count++] = j;
+
+    m = l-1;
+    dbl = 0;
+    while(m>=0) {
+	if (!s[m]) {
+	    dbl++;
+	    m--;
+	} else {
+	    l = m - windowsize + 1;
+	    if (l < 0) l = 0;
+	    for (; l<m; l++) {
+		if (s[l]) break;
+	    }
+	    j = s[l];
+	    dbl++;
+	    i = 1;
+	    for (k=l+1; k<=m; k++) {
+		i = i << 1;
+		j += s[k] * i;
+		dbl++;
+	    }
+	    step[count++] = dbl;
+	    step[count++] = j;
+	    dbl = 0;
+	    m = l-1;
+	}
+    }
+    if (dbl) {
+	step[count++] = dbl;
+	step[count++] = 0;
+    }
+
+    if (s != sbuf) free(s);
+    return count;
+}
+
+int curve_init(curve_t curve, mpz_t prime, mpz_t qprime)
 //initializes system parameters
 //not thread-safe
 {
@@ -92,6 +178,12 @@ void curve_init(curve_t curve, mpz_t prime, mpz_t qprime)
     int count = 0;
     int j;
 
+    //nothing is allocated until the modulus is known to be usable
+    if (!mont_init(curve->mont, prime)) {
+	fprintf(stderr, "curve_init: modulus unsuitable for Montgomery arithmetic\n");
+	return 0;
+    }
+
     mpz_init(curve->p);
     mpz_init(curve->q);
     mpz_init(curve->p1onq);
@@ -135,6 +227,11 @@ void curve_init(curve_t curve, mpz_t prime, mpz_t qprime)
     mpz_add_ui(curve->p1onq, curve->p, 1);
     mpz_div(curve->p1onq, curve->p1onq, curve->q);
 
+    //its recoding, for point_mul_cofactor()
+    curve->p1onq_step = (int *) malloc(sizeof(int)
+	    * (2 * mpz_sizeinbase(curve->p1onq, 2) + 3));
+    curve->p1onq_steps = point_mul_schedule(curve->p1onq_step, curve->p1onq);
+
     //(2*p - 1)/3;
     mpz_mul_ui(curve->cbrtpwr, curve->p, 2);
     mpz_sub_ui(curve->cbrtpwr, curve->cbrtpwr, 1);
@@ -145,78 +242,43 @@ void curve_init(curve_t curve, mpz_t prime, mpz_t qprime)
     mpz_sub_ui(curve->tatepwr, curve->p, 1);
     mpz_mul(curve->tatepwr, curve->tatepwr, curve->p1onq);
 
-    curve->pre_x = (mpz_t *) malloc(sizeof(mpz_t) * (m + 1));
-    curve->pre_y = (mpz_t *) malloc(sizeof(mpz_t) * (m + 1));
-
-    for (i=0; i<=m; i++) {
-	mpz_init(curve->pre_x[i]);
-	mpz_init(curve->pre_y[i]);
-    }
+    curve->lanes_ok = mlanes_init(curve->lanes, curve->mont) && mlanes_ifma();
+    return 1;
 }
 
 void curve_clear(curve_t curve)
 {
-    int i;
-    int m = mpz_sizeinbase(curve->q, 2);
-
     mpz_clear(curve->p);
     mpz_clear(curve->q);
     mpz_clear(curve->p1onq);
     mpz_clear(curve->cbrtpwr);
     mpz_clear(curve->tatepwr);
-
-    for (i=0; i<=m; i++) {
-	mpz_clear(curve->pre_x[i]);
-	mpz_clear(curve->pre_y[i]);
-    }
-    free(curve->pre_x);
-    free(curve->pre_y);
+    free(curve->p1onq_step);
 }
 
 void miller_cache_init(miller_cache_t mc, curve_t curve)
 {
-    int i;
     int m = mpz_sizeinbase(curve->q, 2);
+    int n = curve->mont->n;
 
-    mc->numa = (mpz_t *) malloc(sizeof(mpz_t) * m);
-    mc->numc = (mpz_t *) malloc(sizeof(mpz_t) * m);
-    mc->denomc = (mpz_t *) malloc(sizeof(mpz_t) * m);
-
-    mpz_init(mc->denoms1);
-    mpz_init(mc->denomsb);
-    mpz_init(mc->numl1a);
-    mpz_init(mc->numl1c);
-    mpz_init(mc->denoml1c);
-    mpz_init(mc->numl2c);
-    for (i=0; i<m; i++) {
-	mpz_init(mc->numa[i]);
-	mpz_init(mc->numc[i]);
-	mpz_init(mc->denomc[i]);
-    }
+    mc->numb = (mp_limb_t *) malloc(sizeof(mp_limb_t) * m * n);
+    mc->numc = (mp_limb_t *) malloc(sizeof(mp_limb_t) * m * n);
+    mc->denomc = (mp_limb_t *) malloc(sizeof(mp_limb_t) * m * n);
     mc->count = m;
+    //not every curve uses every fixed entry, so give them all a value
+    mpn_zero(mc->denomsb, n);
+    mpn_zero(mc->denoms1, n);
+    mpn_zero(mc->numl1a, n);
+    mpn_zero(mc->numl1c, n);
+    mpn_zero(mc->denoml1c, n);
+    mpn_zero(mc->numl2c, n);
 }
 
 void miller_cache_clear(miller_cache_t mc)
 {
-    int i;
-    int m = mc->count;
-
-    mpz_clear(mc->denoms1);
-    mpz_clear(mc->denomsb);
-    mpz_clear(mc->numl1a);
-    mpz_clear(mc->numl1c);
-    mpz_clear(mc->denoml1c);
-    mpz_clear(mc->numl2c);
-    for (i=0; i<m; i++) {
-	mpz_clear(mc->numa[i]);
-	mpz_clear(mc->numc[i]);
-	mpz_clear(mc->denomc[i]);
-    }
-
-    free(mc->numa);
+    free(mc->numb);
     free(mc->numc);
     free(mc->denomc);
-
 }
 
 void x_from_y(mpz_t x, mpz_t y, curve_t curve)
@@ -286,7 +348,7 @@ void point_add(point_ptr R, point_ptr P, point_ptr Q, curve_t curve)
 //R = P + Q
 {
     mpz_ptr p = curve->p;
-    fp2_t lambda, temp, temp2;
+    fp2_ptr lambda, temp, temp2;
 
     if (P->infinity) {
 	point_set(R, Q);
@@ -299,9 +361,9 @@ void point_add(point_ptr R, point_ptr P, point_ptr Q, curve_t curve)
 
     R->infinity = 0;
 
-    fp2_init(lambda);
-    fp2_init(temp);
-    fp2_init(temp2);
+    lambda = fp2_scratch_get();
+    temp = fp2_scratch_get();
+    temp2 = fp2_scratch_get();
 
     if (fp2_equal(P->x, Q->x)) { // Px == Py
 	fp2_neg(temp, Q->y, p);
@@ -352,274 +414,333 @@ void point_add(point_ptr R, point_ptr P, point_ptr Q, curve_t curve)
 
     }
 
-    fp2_clear(lambda);
-    fp2_clear(temp);
-    fp2_clear(temp2);
+    fp2_scratch_put(3);
 }
 
-static void proj_double(mpz_t x, mpz_t y, mpz_t z, mpz_t p)
-//(x, y, z) *= 2
+static void mproj_double(mp_ptr x, mp_ptr y, mp_ptr z, mont_ptr m)
+//(x, y, z) *= 2, all in Montgomery form
 //see Blake, Seroussi & Smart, Fig IV.2
 //assumes (x, y, z) is not O, or a point of order 2 (i.e. y != 0)
 //we have a = 0 in our curve
 {
-    mpz_t t1, t2, t3, t4, t5;
-    mpz_init(t1);
-    mpz_init(t2);
-    mpz_init(t3);
-    mpz_init(t4);
-    mpz_init(t5);
+    mp_limb_t t1[mont_maxlimbs], t2[mont_maxlimbs];
+    mp_limb_t t3[mont_maxlimbs], t5[mont_maxlimbs];
 
     //t1 = 3x^2
-    mpz_mul(t1, x, x);
-    mpz_add(t2, t1, t1);
-    mpz_add(t1, t1, t2);
-    mpz_mod(t1, t1, p);
+    mont_sqr(t2, x, m);
+    mont_add(t1, t2, t2, m);
+    mont_add(t1, t1, t2, m);
 
     //z' = 2yz
-    mpz_mul(z, z, y);
-    mpz_add(z, z, z);
-    mpz_mod(z, z, p);
+    mont_mul(z, z, y, m);
+    mont_add(z, z, z, m);
 
     //t2 = 4xy^2, t5 holds y^2
-    mpz_mul(t5, y, y);
-    mpz_mod(t5, t5, p);
-    mpz_mul(t2, t5, x);
-    mpz_mul_2exp(t2, t2, 2);
-    mpz_mod(t2, t2, p);
+    mont_sqr(t5, y, m);
+    mont_mul(t2, t5, x, m);
+    mont_add(t2, t2, t2, m);
+    mont_add(t2, t2, t2, m);
 
     //x' = t1^2 - 2t2
-    mpz_mul(t3, t1, t1);
-    //mpz_mod(t3, t3, p);
-    mpz_add(t4, t2, t2);
-    mpz_sub(x, t3, t4);
-    mpz_mod(x, x, p);
+    mont_sqr(t3, t1, m);
+    mont_sub(x, t3, t2, m);
+    mont_sub(x, x, t2, m);
 
-    //t3 = 8y^2 (recall t5 holds y^2)
-    mpz_mul(t3, t5, t5);
-    //mpz_mod(t3, t3, p);
-    mpz_mul_2exp(t3, t3, 3);
-    mpz_mod(t3, t3, p);
+    //t3 = 8y^4
+    mont_sqr(t3, t5, m);
+    mont_add(t3, t3, t3, m);
+    mont_add(t3, t3, t3, m);
+    mont_add(t3, t3, t3, m);
 
     //y' = t1(t2 - x) - t3
-    mpz_sub(t4, t2, x);
-    mpz_mul(t4, t4, t1);
-    mpz_sub(y, t4, t3);
-    mpz_mod(y, y, p);
-
-    mpz_clear(t1);
-    mpz_clear(t2);
-    mpz_clear(t3);
-    mpz_clear(t4);
-    mpz_clear(t5);
+    mont_sub(t2, t2, x, m);
+    mont_mul(y, t2, t1, m);
+    mont_sub(y, y, t3, m);
 }
 
-static void proj_mix_in(mpz_t x, mpz_t y, mpz_t z, mpz_t a, mpz_t b, mpz_t p)
-//(x, y, z) += (a, b, 1)
+static void mproj_mix_in(mp_ptr x, mp_ptr y, mp_ptr z,
+	mp_srcptr a, mp_srcptr b, mont_ptr m)
+//(x, y, z) += (a, b, 1), all in Montgomery form
 //assumes neither is O, and they are distinct points
 //for now also assume their sum is not O
 //see Blake, Seroussi & Smart, Fig IV.1
 {
     //we take z_2 = 1, so t1 = x, t4 = y
 
-    mpz_t t2, t3, t5, t6, t7, t8;
-    mpz_init(t2);
-    mpz_init(t3);
-    mpz_init(t5);
-    mpz_init(t6);
-    mpz_init(t7);
-    mpz_init(t8);
+    mp_limb_t t2[mont_maxlimbs], t3[mont_maxlimbs], t5[mont_maxlimbs];
+    mp_limb_t t6[mont_maxlimbs], t7[mont_maxlimbs], t8[mont_maxlimbs];
 
     //lambda_2 = x_2 * z_1^2
-    //t8 holds z^2 until t5 has been computed
-    mpz_mul(t8, z, z);
-    mpz_mod(t8, t8, p);
-    mpz_mul(t2, t8, a);
-    mpz_mod(t2, t2, p);
+    mont_sqr(t8, z, m);
+    mont_mul(t2, t8, a, m);
 
     //lambda_3 = lambda_1 - lambda_2
-    mpz_sub(t3, x, t2);
-    //if (!mpz_size(t3)) {
-	//answer is O
-    //}
+    mont_sub(t3, x, t2, m);
 
     //lambda_5 = y_2 * z_1^3
-    mpz_mul(t5, t8, z);
-    mpz_mod(t5, t5, p);
-    mpz_mul(t5, t5, b);
-    mpz_mod(t5, t5, p);
+    mont_mul(t5, t8, z, m);
+    mont_mul(t5, t5, b, m);
 
     //lambda_6 = lambda_4 - lambda_5
-    mpz_sub(t6, y, t5);
+    mont_sub(t6, y, t5, m);
 
     //lambda_7 = lambda_1 + lambda_2
-    mpz_add(t7, x, t2);
+    mont_add(t7, x, t2, m);
 
     //lambda_8 = lambda_4 + lambda_5
-    mpz_add(t8, y, t5);
+    mont_add(t8, y, t5, m);
 
     //z_3 = z_1 z_2 lambda_3
-    mpz_mul(z, z, t3);
-    mpz_mod(z, z, p);
+    mont_mul(z, z, t3, m);
 
     //x_3 = lambda_6^2 - lambda_7 lambda_3^2
-    //t2, t5 no longer needed
     //t2 holds t3^2
-    mpz_mul(t5, t6, t6);
-    mpz_mul(t2, t3, t3);
-    mpz_mod(t2, t2, p);
-    mpz_mul(x, t2, t7);
-    mpz_sub(x, t5, x);
-    mpz_mod(x, x, p);
+    mont_sqr(t5, t6, m);
+    mont_sqr(t2, t3, m);
+    mont_mul(x, t2, t7, m);
+    mont_sub(x, t5, x, m);
 
     //lambda_9 = lambda_7 lambda_3^2 - 2 x_3
-    //t5 doubles as t9
-    //t7 no longer needed after first line
-    mpz_mul(t5, t7, t2);
-    mpz_add(t7, x, x);
-    mpz_sub(t5, t5, t7);
-    mpz_mod(t5, t5, p);
+    mont_mul(t5, t7, t2, m);
+    mont_sub(t5, t5, x, m);
+    mont_sub(t5, t5, x, m);
 
     //y_3 = (lambda_9 lambda_6 - lambda_8 lambda_3^3)/2
-    //t8 no longer needed after second line
-    mpz_mul(t7, t5, t6);
-    mpz_mul(t8, t8, t2);
-    mpz_mod(t8, t8, p);
-    mpz_mul(t8, t8, t3);
-    mpz_sub(y, t7, t8);
-    mpz_mod(y, y, p);
-    if (mpz_odd_p(y)) {
-	mpz_add(y, y, p);
-    }
-    mpz_fdiv_q_2exp(y, y, 1);
-    //is divexact better here?
+    mont_mul(t7, t5, t6, m);
+    mont_mul(t8, t8, t2, m);
+    mont_mul(t8, t8, t3, m);
+    mont_sub(y, t7, t8, m);
+    mont_half(y, y, m);
+}
 
-    mpz_clear(t2);
-    mpz_clear(t3);
-    mpz_clear(t5);
-    mpz_clear(t6);
-    mpz_clear(t7);
-    mpz_clear(t8);
+static void mproj_zaddu(mp_ptr x1, mp_ptr y1, mp_ptr x2, mp_ptr y2,
+	mp_ptr l, mont_ptr m)
+//co-Z addition (Meloni): (x1, y1) and (x2, y2) share the same z
+//(x2, y2) += (x1, y1), and (x1, y1) becomes the same point for the new
+//common z, which is l times the old one
+//assumes the points are distinct and not negatives of each other
+//(l = 0 otherwise)
+{
+    mp_limb_t t1[mont_maxlimbs], t2[mont_maxlimbs];
+    mp_limb_t t3[mont_maxlimbs], t4[mont_maxlimbs];
+
+    //A = (x2 - x1)^2, B = x1 A, C = x2 A
+    mont_sub(l, x2, x1, m);
+    mont_sqr(t1, l, m);
+    mont_mul(t2, x1, t1, m);
+    mont_mul(t3, x2, t1, m);
+
+    //x3 = (y2 - y1)^2 - B - C
+    mont_sub(t4, y2, y1, m);
+    mont_sqr(t1, t4, m);
+    mont_sub(x2, t1, t2, m);
+    mont_sub(x2, x2, t3, m);
+
+    //y1' = y1 (C - B)
+    mont_sub(t3, t3, t2, m);
+    mont_mul(y1, y1, t3, m);
+
+    //y3 = (y2 - y1)(B - x3) - y1'
+    mont_sub(t1, t2, x2, m);
+    mont_mul(y2, t4, t1, m);
+    mont_sub(y2, y2, y1, m);
+
+    //x1' = B
+    mont_set(x1, t2, m);
 }
 
-static void tate_power(fp2_t res, curve_t curve)
+static void mproj_add(mp_ptr x, mp_ptr y, mp_ptr z,
+	mp_srcptr a, mp_srcptr b, mp_srcptr c, mont_ptr m)
+//(x, y, z) += (a, b, c), or (a, b, 1) if c is NULL, all in Montgomery form
+//a point with z = 0 is O
+//unlike mproj_mix_in this handles every case, including doubling
 {
-    fp2_t t0;
+    mp_limb_t u1[mont_maxlimbs], s1[mont_maxlimbs];
+    mp_limb_t u2[mont_maxlimbs], s2[mont_maxlimbs];
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs];
+
+    if (c && mont_is_0(c, m)) return;
+    if (mont_is_0(z, m)) {
+	mont_set(x, a, m);
+	mont_set(y, b, m);
+	if (c) mont_set(z, c, m);
+	else mont_set_1(z, m);
+	return;
+    }
+
+    //u1 = x c^2, s1 = y c^3
+    if (c) {
+	mont_sqr(t0, c, m);
+	mont_mul(u1, x, t0, m);
+	mont_mul(t0, t0, c, m);
+	mont_mul(s1, y, t0, m);
+    } else {
+	mont_set(u1, x, m);
+	mont_set(s1, y, m);
+    }
+
+    //u2 = a z^2, s2 = b z^3
+    mont_sqr(t0, z, m);
+    mont_mul(u2, a, t0, m);
+    mont_mul(t0, t0, z, m);
+    mont_mul(s2, b, t0, m);
+
+    //u2 = h = u2 - u1, s2 = r = s2 - s1
+    mont_sub(u2, u2, u1, m);
+    mont_sub(s2, s2, s1, m);
+    if (mont_is_0(u2, m)) {
+	if (mont_is_0(s2, m)) mproj_double(x, y, z, m);
+	else mont_set_0(z, m);
+	return;
+    }
+
+    //z' = z c h
+    if (c) mont_mul(z, z, c, m);
+    mont_mul(z, z, u2, m);
 
-    fp2_init(t0);
+    //t0 = h^2, t1 = h^3, u1 = u1 h^2
+    mont_sqr(t0, u2, m);
+    mont_mul(t1, t0, u2, m);
+    mont_mul(u1, u1, t0, m);
 
-    fp2_pow(t0, res, curve->p1onq, curve->p);
-    mpz_set(res->a, t0->a);
-    mpz_sub(res->b, curve->p, t0->b);
-    fp2_div(res, res, t0, curve->p);
+    //x' = r^2 - h^3 - 2 u1 h^2
+    mont_sqr(x, s2, m);
+    mont_sub(x, x, t1, m);
+    mont_sub(x, x, u1, m);
+    mont_sub(x, x, u1, m);
 
-    fp2_clear(t0);
+    //y' = r (u1 h^2 - x') - s1 h^3
+    mont_sub(u1, u1, x, m);
+    mont_mul(y, s2, u1, m);
+    mont_mul(t1, t1, s1, m);
+    mont_sub(y, y, t1, m);
 }
 
-static void pts_get_vertical(fp2_ptr v,
-	point_ptr A, point_ptr P, mpz_ptr z, mpz_t p)
+static void mproj_to_affine(mp_ptr x, mp_ptr y, mp_ptr z, mont_ptr m)
+//(x, y, z) = (x/z^2, y/z^3, 1)
 {
-    mpz_t z2;
-    fp2_t temp;
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs];
+
+    mont_inv(t0, z, m);
+    mont_sqr(t1, t0, m);
+    mont_mul(x, x, t1, m);
+    mont_mul(t1, t1, t0, m);
+    mont_mul(y, y, t1, m);
+    mont_set_1(z, m);
+}
 
-    mpz_init(z2);
-    fp2_init(temp);
+static void tate_power_array(fp2m_t *x, int n, curve_t curve)
+//x[k] = x[k]^((p^2 - 1)/q) for 0 <= k < n
+//the (p - 1) part is done first: x^p is the conjugate of x, so
+//x^(p-1) = conj(x)/x = conj(x)^2 / (a^2 + b^2)
+//this has norm 1, so the (p + 1)/q part can use fp2m_pow_unitary()
+//the norms are inverted together
+{
+    fp2m_t y;
+    mp_limb_t t1[mont_maxlimbs];
+    mp_limb_t t0buf[mont_maxlimbs * miller_batch_chunk];
+    mp_ptr t0;
+    mont_ptr m = curve->mont;
+    int k;
+
+    if (n <= 0) return;
+    if (n <= miller_batch_chunk) t0 = t0buf;
+    else t0 = (mp_ptr) malloc(sizeof(mp_limb_t) * n * m->n);
+    for (k=0; k<n; k++) {
+	mont_sqr(t0 + k * m->n, x[k]->a, m);
+	mont_sqr(t1, x[k]->b, m);
+	mont_add(t0 + k * m->n, t0 + k * m->n, t1, m);
+    }
+    mont_batch_inv(t0, t0, n, m);
+    for (k=0; k<n; k++) {
+	fp2m_conj(y, x[k], m);
+	fp2m_sqr(y, y, m);
+	fp2m_mul_mont(y, y, t0 + k * m->n, m);
+	fp2m_pow_unitary(x[k], y, curve->p1onq, m);
+    }
+    if (t0 != t0buf) free(t0);
+}
 
-    assert(!A->infinity);
-    assert(!P->infinity); // (could handle with a = b = 0; c = 1;)
+static void tate_power(fp2_t res, curve_t curve)
+//res = res^((p^2 - 1)/q)
+{
+    fp2m_t x[1];
+    mont_ptr m = curve->mont;
 
-    //a = 1; b = 0; c = -P.x;
-    zp_mul(z2, z, z, p);
-    fp2_mul_mpz(temp, A->x, z2, p);
-    zp_sub(temp->a, temp->a, P->x->a, p);
-    fp2_mul(v, v, temp, p);
+    fp2m_set_fp2(x[0], res, m);
+    tate_power_array(x, 1, curve);
+    fp2m_get_fp2(res, x[0], m);
+}
 
-    mpz_clear(z2);
-    fp2_clear(temp);
+static void pts_get_vertical(fp2m_ptr v, fp2m_ptr Ax,
+	mp_srcptr x, mp_srcptr z, mont_ptr m)
+//v *= vertical through (x, y, z) evaluated at A
+//everything in Montgomery form
+{
+    mp_limb_t z2[mont_maxlimbs];
+    fp2m_t temp;
+
+    //a = 1; b = 0; c = -P.x;
+    mont_sqr(z2, z, m);
+    fp2m_mul_mont(temp, Ax, z2, m);
+    mont_sub(temp->a, temp->a, x, m);
+    fp2m_mul(v, v, temp, m);
 }
 
-static void pts_get_tangent(fp2_ptr v,
-	point_ptr A, point_ptr P, mpz_t z, mpz_t p)
+static void pts_get_tangent(fp2m_ptr v, fp2m_ptr Ax, fp2m_ptr Ay,
+	mp_srcptr x, mp_srcptr y, mp_srcptr z, mont_ptr m)
+//v *= tangent at (x, y, z) evaluated at A
+//everything in Montgomery form
 {
     //note: z is in F_p so we can multiply by arbitrary
     //powers of z because it gets killed by Tate exp.
     //to derive what I have: x --> x/z^2, y/z^3 and then multiply
     //by appropriate power of z
-    mpz_t a, b, c;
-    mpz_t temp, temp2;
-    fp2_t f1, f2;
+    mp_limb_t a[mont_maxlimbs], b[mont_maxlimbs], c[mont_maxlimbs];
+    mp_limb_t temp[mont_maxlimbs], temp2[mont_maxlimbs];
+    fp2m_t f1;
+    fp2m_acc_t acc;
 
-    fp2_init(f1);
-    fp2_init(f2);
     //it should be
     //a = -slope_tangent(P.x, P.y);
     //b = 1;
     //c = -(P.y + a * P.x);
     //but we multiply by 2*P.y to avoid division
 
-    assert(!P->infinity); //(could handle with a = b = 0; c = 1;)
-    assert(!fp2_is_0(P->y)); // need to be wary of points of order 2
-    //could handle with pts_get_vertical(v, A, P, z);
-
-    mpz_init(a);
-    mpz_init(b);
-    mpz_init(c);
-    mpz_init(temp);
-    mpz_init(temp2);
+    assert(!mont_is_0(y, m)); // need to be wary of points of order 2
 
     //a = -3x^2 * z^2 (assume a2 = a4 = 0)
-#if 1
-    zp_mul(temp2, P->x->a, P->x->a, p);
-    zp_add(temp, temp2, temp2, p);
-    zp_add(temp, temp, temp2, p);
-    zp_neg(a, temp, p);
-#else
-    mpz_mul(temp2, P->x->a, P->x->a);
-    mpz_add(temp, temp2, temp2);
-    mpz_add(temp, temp, temp2);
-    mpz_neg(a, temp);
-    mpz_mod(a, a, p);
-#endif
-    zp_mul(temp2, z, z, p);
-    zp_mul(a, a, temp2, p);
+    mont_sqr(temp2, x, m);
+    mont_add(temp, temp2, temp2, m);
+    mont_add(temp, temp, temp2, m);
+    mont_neg(a, temp, m);
+    mont_sqr(temp2, z, m);
+    mont_mul(a, a, temp2, m);
 
-    zp_mul(temp2, temp2, z, p);
+    mont_mul(temp2, temp2, z, m);
 
     //b = (y + y)z^3;
-    zp_add(b, P->y->a, P->y->a, p);
-    zp_mul(b, b, temp2, p);
+    mont_add(b, y, y, m);
+    mont_mul(b, b, temp2, m);
 
     //c = - (2y) * y - (-3x^2) * x;
-    zp_mul(c, temp, P->x->a, p);
-    zp_mul(temp2, P->y->a, P->y->a, p);
-    zp_add(temp2, temp2, temp2, p);
-    zp_sub(c, c, temp2, p);
-
-    assert(!A->infinity);
-
-    fp2_mul_mpz(f1, A->x, a, p);
-    fp2_mul_mpz(f2, A->y, b, p);
-    fp2_add(f1, f1, f2, p);
-    //zp_mul(b, A->y->a, b, p);
-    //zp_add(f1->a, f1->a, b, p);
-    zp_add(f1->a, f1->a, c, p);
-    fp2_mul(v, v, f1, p);
-
-    fp2_clear(f1);
-    fp2_clear(f2);
-
-    mpz_clear(a);
-    mpz_clear(b);
-    mpz_clear(c);
-    mpz_clear(temp);
-    mpz_clear(temp2);
-    return;
+    mont_mul(c, temp, x, m);
+    mont_sqr(temp2, y, m);
+    mont_add(temp2, temp2, temp2, m);
+    mont_sub(c, c, temp2, m);
+
+    //f1 = a A.x + b A.y with one reduction per coordinate
+    fp2m_acc_set_0(acc, m);
+    fp2m_acc_addmul_mont(acc, Ax, a, m);
+    fp2m_acc_addmul_mont(acc, Ay, b, m);
+    fp2m_acc_reduce(f1, acc, m);
+    mont_add(f1->a, f1->a, c, m);
+    fp2m_mul(v, v, f1, m);
 }
 
 static void tate_get_vertical(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 {
-    fp2_t temp;
-    fp2_init(temp);
+    fp2_ptr temp;
 
     if (A->infinity) {
 	fprintf(stderr, "can't evaluate at O!\n");
@@ -630,17 +751,18 @@ static void tate_get_vertical(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 	//a = b = 0; c = 1;
 	return;
     }
+    temp = fp2_scratch_get();
     //a = 1; b = 0; c = -P.x;
     fp2_sub(temp, A->x, P->x, p);
     fp2_mul(v, v, temp, p);
 
-    fp2_clear(temp);
+    fp2_scratch_put(1);
 }
 
 static void tate_get_tangent(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 {
-    fp2_t a, b, c;
-    fp2_t temp, temp2;
+    fp2_ptr a, b, c;
+    fp2_ptr temp, temp2;
     //it should be
     //a = -slope_tangent(P.x, P.y);
     //b = 1;
@@ -655,7 +777,7 @@ static void tate_get_tangent(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 	return;
     }
 
-    fp2_init(temp);
+    temp = fp2_scratch_get();
 
     //need to be wary of points of order 2
     if (fp2_is_0(P->y)) {
@@ -663,14 +785,14 @@ static void tate_get_tangent(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 	fp2_sub(temp, A->x, P->x, p);
 	fp2_mul(v, v, temp, p);
 
-	fp2_clear(temp);
+	fp2_scratch_put(1);
 	return;
     }
 
-    fp2_init(a);
-    fp2_init(b);
-    fp2_init(c);
-    fp2_init(temp2);
+    a = fp2_scratch_get();
+    b = fp2_scratch_get();
+    c = fp2_scratch_get();
+    temp2 = fp2_scratch_get();
 
     fp2_add(temp, P->x, P->x, p);
     fp2_add(temp, temp, P->x, p);
@@ -697,18 +819,14 @@ static void tate_get_tangent(fp2_ptr v, point_ptr A, point_ptr P, mpz_t p)
 	fp2_mul(v, v, temp, p);
     }
 
-    fp2_clear(a);
-    fp2_clear(b);
-    fp2_clear(c);
-    fp2_clear(temp);
-    fp2_clear(temp2);
+    fp2_scratch_put(5);
     return;
 }
 
 static void tate_get_line(fp2_ptr v, point_ptr A, point_ptr P, point_ptr Q, mpz_t p)
 {
-    fp2_t a, b, c;
-    fp2_t temp, temp2;
+    fp2_ptr a, b, c;
+    fp2_ptr temp, temp2;
 
     //cases involving O
     if (P->infinity) {
@@ -720,7 +838,7 @@ static void tate_get_line(fp2_ptr v, point_ptr A, point_ptr P, point_ptr Q, mpz_
 	return;
     }
 
-    fp2_init(temp);
+    temp = fp2_scratch_get();
 
     //check if we need a tangent or vertical
     if (fp2_equal(P->x, Q->x)) {
@@ -730,20 +848,20 @@ static void tate_get_line(fp2_ptr v, point_ptr A, point_ptr P, point_ptr Q, mpz_
 	    fp2_sub(temp, A->x, P->x, p);
 	    fp2_mul(v, v, temp, p);
 
-	    fp2_clear(temp);
+	    fp2_scratch_put(1);
 	    return;
 	}
 	//othewise P = Q
-	fp2_clear(temp);
+	fp2_scratch_put(1);
 	tate_get_tangent(v, A, P, p);
 	return;
 
     }
     //normal case (P != Q)
-    fp2_init(a);
-    fp2_init(b);
-    fp2_init(c);
-    fp2_init(temp2);
+    a = fp2_scratch_get();
+    b = fp2_scratch_get();
+    c = fp2_scratch_get();
+    temp2 = fp2_scratch_get();
 
     //it should be
     //a = -(Q.y - P.y) / (Q.x - P.x);
@@ -767,11 +885,7 @@ static void tate_get_line(fp2_ptr v, point_ptr A, point_ptr P, point_ptr Q, mpz_
 	fp2_mul(v, v, temp, p);
     }
 
-    fp2_clear(a);
-    fp2_clear(b);
-    fp2_clear(c);
-    fp2_clear(temp);
-    fp2_clear(temp2);
+    fp2_scratch_put(5);
 }
 
 static void get_vertical(fp2_ptr v, fp2_ptr vdenom,
@@ -1181,71 +1295,8 @@ bad_R:
     return 0;
 }
 
-static void pts_preprocess_vertical(miller_cache_t mc,
-	int i, point_t P, mpz_t z, mpz_t p)
-{
-    mpz_t t0;
-
-    mpz_init(t0);
-
-    mpz_mul(t0, z, z);
-    mpz_invert(t0, t0, p);
-
-    mpz_mul(t0, t0, P->x->a);
-    mpz_neg(t0, t0);
-    mpz_mod(mc->denomc[i], t0, p);
-
-    mpz_clear(t0);
-}
-
-void pts_preprocess_tangent(miller_cache_t mc,
-	int i, point_t P, mpz_t z, mpz_t p)
-{
-    mpz_t t0;
-    mpz_t *numa, *numc;
-
-    mpz_init(t0);
-    numa = mc->numa;
-    numc = mc->numc;
-
-    assert(mpz_cmp_ui(P->y->a, 0)); //assume P not of order 2
-    //could handle with:
-    //{
-    //	mpz_set_ui(numa[i], 1);
-    //	mpz_set(numc[i], P->x->a);
-    //	return;
-    //}
-
-    //a = -3x^2/2yz
-    //c = -(y + a * xz)/z^3;
-
-    mpz_mul_2exp(t0, P->y->a, 1);
-    mpz_mul(t0, t0, z);
-    mpz_invert(t0, t0, p);
-    mpz_mul(t0, t0, P->x->a);
-    mpz_mul(t0, t0, P->x->a);
-    mpz_mul_si(t0, t0, -3);
-    mpz_mod(numa[i], t0, p);
-
-    mpz_mul(t0, z, z);
-    mpz_mul(t0, t0, z);
-    mpz_invert(t0, t0, p);
-    mpz_mul(numc[i], numa[i], P->x->a);
-    mpz_mul(numc[i], numc[i], z);
-    mpz_add(numc[i], numc[i], P->y->a);
-    mpz_neg(numc[i], numc[i]);
-    mpz_mul(t0, numc[i], t0);
-    mpz_mod(numc[i], t0, p);
-
-    mpz_clear(t0);
-}
-
 void pts_preprocess_line(mpz_t a, mpz_t c, point_t P, point_t Q, mpz_t p)
 {
-    mpz_t t0;
-
-    mpz_init(t0);
-
     //assume P.x != Q.x
 
     //a = -(Q.y - P.y) / (Q.x - P.x);
@@ -1261,14 +1312,15 @@ void pts_preprocess_line(mpz_t a, mpz_t c, point_t P, point_t Q, mpz_t p)
     mpz_add(c, c, P->y->a);
     mpz_neg(c, c);
     mpz_mod(c, c, p);
-
-    mpz_clear(t0);
 }
 
 void tate_preprocess(miller_cache_t mc, point_ptr P, curve_t curve)
 //for primes of the form 2^a +- 2^b +- 1
 //uses proj. coords, assumes P is a point over F_p
 //and that order of group = Solinas prime
+//the doubling loop stores line coefficients as fractions and
+//all denominators are inverted together at the end, so building
+//the cache costs about as much as one Miller loop
 {
     //specialized for Solinas primes
     int a, b;
@@ -1276,12 +1328,17 @@ void tate_preprocess(miller_cache_t mc, point_ptr P, curve_t curve)
 
     point_t Z;
     int i;
-    mpz_t z, temp;
+    mpz_ptr z, temp;
     mpz_ptr p = curve->p;
+    mont_ptr m = curve->mont;
+    mp_size_t n = m->n;
+    mp_limb_t x[mont_maxlimbs], y[mont_maxlimbs], zz[mont_maxlimbs];
+    mp_limb_t bx[mont_maxlimbs], by[mont_maxlimbs];
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs];
+    mp_ptr den;
 
-    mpz_init(z);
-    mpz_init(temp);
-    mpz_set_ui(z, 1);
+    z = zp_scratch_get();
+    temp = zp_scratch_get();
 
     a = abs(curve->solinasa);
     b = abs(curve->solinasb);
@@ -1289,77 +1346,118 @@ void tate_preprocess(miller_cache_t mc, point_ptr P, curve_t curve)
     point_init(Z);
     point_init(bP);
 
-    point_set(Z, P);
-    i = 0;
-    if (b != 0) {
-	//work out f_2^b
-	for(;i<b; i++) {
-	    //g
-	    //tate_get_tangent(v, Qhat, Z, p);
-	    //pts_get_tangent(v, Qhat, Z, z);
-	    pts_preprocess_tangent(mc, i, Z, z, p);
-	    //h
-	    //point_add(Z, Z, Z, curve);
-	    proj_double(Z->x->a, Z->y->a, z, p);
-	    //tate_get_vertical(vdenom, Qhat, Z, p);
-	    //pts_get_vertical(vdenom, Qhat, Z, z, p);
-	    pts_preprocess_vertical(mc, i, Z, z, p);
+    //den holds, for step i, the denominators of the tangent (2i)
+    //and of the vertical (2i + 1), then the z-coordinates of 2^b P
+    //and 2^a P
+    den = (mp_ptr) malloc(sizeof(mp_limb_t) * n * (2 * a + 2));
+
+    mont_set_mpz(x, P->x->a, m);
+    mont_set_mpz(y, P->y->a, m);
+    mont_set_1(zz, m);
+    mont_set_1(den + 2 * a * n, m);
+
+    for (i=0; i<a; i++) {
+	if (b != 0 && i == b) {
+	    //remember 2^b P
+	    mont_set(bx, x, m);
+	    mont_set(by, y, m);
+	    mont_set(den + 2 * a * n, zz, m);
 	}
+	//g
+	//tangent at (x, y, z) as in pts_get_tangent, scaled so that
+	//the coefficient of x is 1, i.e.
+	//numb = -2yz^3 / 3x^2z^2, numc = (2y^2 - 3x^3) / 3x^2z^2
+	assert(!mont_is_0(y, m)); //assume P not of order 2
+	assert(!mont_is_0(x, m)); //or 3
+	mont_sqr(t0, x, m);
+	mont_add(t1, t0, t0, m);
+	mont_add(t0, t0, t1, m);
+	mont_mul(t1, t0, x, m);
+	mont_sqr(mc->numc + i * n, y, m);
+	mont_add(mc->numc + i * n, mc->numc + i * n, mc->numc + i * n, m);
+	mont_sub(mc->numc + i * n, mc->numc + i * n, t1, m);
+	mont_sqr(t1, zz, m);
+	mont_mul(den + 2 * i * n, t0, t1, m);
+	mont_mul(t1, t1, zz, m);
+	mont_mul(t1, t1, y, m);
+	mont_add(t1, t1, t1, m);
+	mont_neg(mc->numb + i * n, t1, m);
+	//h
+	mproj_double(x, y, zz, m);
+	//vertical: denomc = -x / z^2
+	mont_neg(mc->denomc + i * n, x, m);
+	mont_sqr(den + (2 * i + 1) * n, zz, m);
+    }
+    mont_set(den + (2 * a + 1) * n, zz, m);
+
+    mont_batch_inv(den, den, 2 * a + 2, m);
+
+    for (i=0; i<a; i++) {
+	mont_mul(mc->numb + i * n, mc->numb + i * n, den + 2 * i * n, m);
+	mont_mul(mc->numc + i * n, mc->numc + i * n, den + 2 * i * n, m);
+	mont_mul(mc->denomc + i * n, mc->denomc + i * n,
+		den + (2 * i + 1) * n, m);
+    }
 
-	mpz_invert(z, z, p);
-	zp_mul(temp, z, z, p);
-	fp2_mul_mpz(Z->x, Z->x, temp, p);
-	zp_mul(temp, temp, z, p);
-	fp2_mul_mpz(Z->y, Z->y, temp, p);
-	mpz_set_ui(z, 1);
+    //Z = 2^a P in affine coordinates
+    mont_sqr(t0, den + (2 * a + 1) * n, m);
+    mont_mul(t1, t0, den + (2 * a + 1) * n, m);
+    mont_mul(x, x, t0, m);
+    mont_mul(y, y, t1, m);
+    mont_get_mpz(Z->x->a, x, m);
+    mont_get_mpz(Z->y->a, y, m);
+    mpz_set_ui(Z->x->b, 0);
+    mpz_set_ui(Z->y->b, 0);
+    Z->infinity = 0;
 
-	point_set(bP, Z);
+    if (b != 0) {
+	//bP = 2^b P in affine coordinates
+	mont_sqr(t0, den + 2 * a * n, m);
+	mont_mul(t1, t0, den + 2 * a * n, m);
+	mont_mul(bx, bx, t0, m);
+	mont_mul(by, by, t1, m);
+	mont_get_mpz(bP->x->a, bx, m);
+	mont_get_mpz(bP->y->a, by, m);
+	mpz_set_ui(bP->x->b, 0);
+	mpz_set_ui(bP->y->b, 0);
+	bP->infinity = 0;
 
 	if (curve->solinasb < 0) {
-	    //tate_get_vertical(fbdenom, Qhat, Z);
-	    mpz_neg(mc->denomsb, Z->x->a);
+	    //tate_get_vertical(fbdenom, Qhat, bP);
+	    mpz_sub(temp, p, bP->x->a);
+	    mont_set_mpz(mc->denomsb, temp, m);
 	    fp2_neg(bP->y, bP->y, p);
 	}
     }
 
-    //work out f_2^a
-    for(; i<a; i++) {
-	//g
-	//pts_get_tangent(v, Qhat, Z, z);
-	pts_preprocess_tangent(mc, i, Z, z, p);
-	//h
-	proj_double(Z->x->a, Z->y->a, z, p);
-	//pts_get_vertical(vdenom, Qhat, Z, z);
-	pts_preprocess_vertical(mc, i, Z, z, p);
-    }
-
-    mpz_invert(z, z, p);
-    zp_mul(temp, z, z, p);
-    fp2_mul_mpz(Z->x, Z->x, temp, p);
-    zp_mul(temp, temp, z, p);
-    fp2_mul_mpz(Z->y, Z->y, temp, p);
-    mpz_set_ui(z, 1);
+    free(den);
 
     //work out f_(2^a +- 2^b +- 1)
     if (b != 0) {
 	//g
 	//tate_get_line(v, Qhat, Z, bP);
-	pts_preprocess_line(mc->numl1a, mc->numl1c, Z, bP, p);
+	//(z is free to use as a temporary now)
+	pts_preprocess_line(z, temp, Z, bP, p);
+	mont_set_mpz(mc->numl1a, z, m);
+	mont_set_mpz(mc->numl1c, temp, m);
 	//h
 	point_add(Z, Z, bP, curve);
 	//tate_get_vertical(vdenom, Qhat, Z);
-	mpz_sub(mc->denoml1c, p, Z->x->a);
+	mpz_sub(temp, p, Z->x->a);
+	mont_set_mpz(mc->denoml1c, temp, m);
     }
     //the sign of solinasa records whether it's +1 or -1
     if (curve->solinasa < 0) {
 	//tate_get_vertical(vdenom, Qhat, Z);
-	mpz_sub(mc->denoms1, p, Z->x->a);
+	mpz_sub(temp, p, Z->x->a);
+	mont_set_mpz(mc->denoms1, temp, m);
     }
 
     //g
     //tate_get_line(v, Qhat, Z, cP);
     //now Z = -cP so g is vertical
-    mpz_sub(mc->numl2c, p, Z->x->a);
+    mpz_sub(temp, p, Z->x->a);
+    mont_set_mpz(mc->numl2c, temp, m);
     //h
     //point_add(Z, Z, cP, curve);
     //now Z = O, so h = 1
@@ -1368,294 +1466,581 @@ void tate_preprocess(miller_cache_t mc, point_ptr P, curve_t curve)
     point_clear(Z);
     point_clear(bP);
 
-    mpz_clear(z);
-    mpz_clear(temp);
+    fp2_scratch_put(2);
 }
 
-void miller_postprocess(fp2_ptr res, miller_cache_t mc,
-	point_ptr Q, curve_t curve)
-//for primes of the form 2^a +- 2^b +- 1
-//uses proj. coords, assumes P is a point over F_p
-//and that order of group = Solinas prime
+static void miller_mul_line_pair(fp2m_ptr v, mp_srcptr u, mp_srcptr u1,
+	mp_srcptr B, mp_srcptr B2, mont_ptr m)
+//v = v (u + Bi)(u1 - Bi) for u, u1, B in F_p, where B2 = B^2
+//the second factor is u u1 + B^2 + B(u1 - u)i, so this costs
+//2 multiplications in F_p on top of one in F_p^2
+{
+    fp2m_t t;
+    mp_limb_t d[mont_maxlimbs];
+
+    mont_mul(t->a, u, u1, m);
+    mont_add(t->a, t->a, B2, m);
+    mont_sub(d, u1, u, m);
+    mont_mul(t->b, B, d, m);
+    fp2m_mul(v, v, t, m);
+}
+
+struct miller_lane_s {
+    //state for one point Q in miller_postprocess_lanes
+    fp2m_t Qx, Qy;
+    fp2m_t cQx; //conjugate of Qx, for the verticals
+    mp_limb_t B2[mont_maxlimbs]; //square of the imaginary part of Qx
+    int sparse; //whether Qy lies in F_p
+    fp2m_t v, fb;
+};
+
+static void miller_lane_init(struct miller_lane_s *s, point_ptr Q, mont_ptr m)
+{
+    fp2m_set_fp2(s->Qx, Q->x, m);
+    fp2m_set_fp2(s->Qy, Q->y, m);
+    fp2m_conj(s->cQx, s->Qx, m);
+    s->sparse = mont_is_0(s->Qy->b, m);
+    mont_sqr(s->B2, s->Qx->b, m);
+}
+
+static void miller_postprocess_lanes(struct miller_lane_s *s, int count,
+	miller_cache_t mc, curve_t curve)
+//s[k].v = the Miller function of mc at s[k].Q, for 0 <= k < count
+//as miller_postprocess, but each entry of mc is read once for all
+//the lanes, and the lanes are independent of each other
 {
     //specialized for Solinas primes
     int a, b;
-    fp2_t fb, fbdenom;
-    fp2_t t0;
-    fp2_t vdenom, v;
-    int i;
-    mpz_t *numa, *numc;
-    mpz_t *denomc;
-    mpz_ptr p = curve->p;
-
-    numa = mc->numa;
-    numc = mc->numc;
-    denomc = mc->denomc;
+    fp2m_t t0;
+    int i, k;
+    mont_ptr m = curve->mont;
+    int n = m->n;
+    mp_limb_t *numb, *numc, *denomc;
+    mp_limb_t u[mont_maxlimbs], u1[mont_maxlimbs];
 
     a = abs(curve->solinasa);
     b = abs(curve->solinasb);
 
-    fp2_init(t0);
-    fp2_init(vdenom);
-    fp2_init(v);
-    fp2_init(fb);
-    fp2_init(fbdenom);
-
-    fp2_set_1(v);
-    fp2_set_1(vdenom);
-
     //f_1 = 1
+    for (k=0; k<count; k++) {
+	fp2m_set_1(s[k].v, m);
+    }
+
+    //work out f_2^a, and f_2^b on the way
+    for (i=0; i<a; i++) {
+	numb = mc->numb + i * n;
+	numc = mc->numc + i * n;
+	denomc = mc->denomc + i * n;
+	for (k=0; k<count; k++) {
+	    if (b != 0 && i == b) {
+		if (curve->solinasb < 0) {
+		    //fb = 1/(f_2^b times the vertical at 2^b P)
+		    fp2m_conj(s[k].fb, s[k].v, m);
+		    {
+			fp2m_set(t0, s[k].cQx, m);
+			mont_add(t0->a, t0->a, mc->denomsb, m);
+			fp2m_mul(s[k].fb, s[k].fb, t0, m);
+		    }
+		} else {
+		    fp2m_set(s[k].fb, s[k].v, m);
+		}
+	    }
+	    fp2m_sqr(s[k].v, s[k].v, m);
+	    if (s[k].sparse) {
+		//g h
+		mont_mul(u, s[k].Qy->a, numb, m);
+		mont_add(u, u, s[k].Qx->a, m);
+		mont_add(u, u, numc, m);
+		mont_add(u1, s[k].Qx->a, denomc, m);
+		miller_mul_line_pair(s[k].v, u, u1, s[k].Qx->b, s[k].B2, m);
+	    } else {
+		//g
+		//pts_get_tangent(v, Qhat, Z, z, p);
+		{
+		    fp2m_mul_mont(t0, s[k].Qy, numb, m);
+		    fp2m_add(t0, t0, s[k].Qx, m);
+		    mont_add(t0->a, t0->a, numc, m);
+		    fp2m_mul(s[k].v, s[k].v, t0, m);
+		}
+		//h
+		//pts_get_vertical(vdenom, Qhat, Z, z, p);
+		{
+		    fp2m_set(t0, s[k].cQx, m);
+		    mont_add(t0->a, t0->a, denomc, m);
+		    fp2m_mul(s[k].v, s[k].v, t0, m);
+		}
+	    }
+	}
+    }
 
-    i = 0;
-    if (b != 0) {
-	//work out f_2^b
-	for(;i<b; i++) {
-	    fp2_sqr(v, v, p);
-	    fp2_sqr(vdenom, vdenom, p);
+    for (k=0; k<count; k++) {
+	//work out f_(2^a +- 2^b +- 1)
+	if (b != 0) {
+	    fp2m_mul(s[k].v, s[k].v, s[k].fb, m);
 	    //g
-	    //tate_get_tangent(v, Qhat, Z, p);
-	    //pts_get_tangent(v, Qhat, Z, z, p);
+	    //tate_get_line(v, Qhat, Z, bP, p);
 	    {
-		fp2_mul_mpz(t0, Q->x, numa[i], p);
-		fp2_add(t0, t0, Q->y, p);
-		mpz_add(t0->a, t0->a, numc[i]);
-		fp2_mul(v, v, t0, p);
+		fp2m_mul_mont(t0, s[k].Qx, mc->numl1a, m);
+		fp2m_add(t0, t0, s[k].Qy, m);
+		mont_add(t0->a, t0->a, mc->numl1c, m);
+		fp2m_mul(s[k].v, s[k].v, t0, m);
 	    }
 	    //h
 	    //tate_get_vertical(vdenom, Qhat, Z, p);
-	    //pts_get_vertical(vdenom, Qhat, Z, z, p);
 	    {
-		fp2_set(t0, Q->x);
-		mpz_add(t0->a, t0->a, denomc[i]);
-		fp2_mul(vdenom, vdenom, t0, p);
+		fp2m_set(t0, s[k].cQx, m);
+		mont_add(t0->a, t0->a, mc->denoml1c, m);
+		fp2m_mul(s[k].v, s[k].v, t0, m);
 	    }
 	}
 
-	if (curve->solinasb < 0) {
-	    fp2_set(fbdenom, v);
-	    fp2_set(fb, vdenom);
-	    //tate_get_vertical(fbdenom, Qhat, Z, p);
-	    {
-		fp2_set(t0, Q->x);
-		mpz_add(t0->a, t0->a, mc->denomsb);
-		fp2_mul(fbdenom, fbdenom, t0, p);
-	    }
+	//g
+	//tate_get_line(v, Qhat, Z, cP);
+	//(the line is x + numl2c, which pairs up with the vertical
+	//when there is one)
+	mont_add(u, s[k].Qx->a, mc->numl2c, m);
+	if (curve->solinasa < 0) {
+	//the sign of solinasa records whether it's +1 or -1
+	    //tate_get_vertical(vdenom, Qhat, P);
+	    mont_add(u1, s[k].Qx->a, mc->denoms1, m);
+	    miller_mul_line_pair(s[k].v, u, u1, s[k].Qx->b, s[k].B2, m);
 	} else {
-	    fp2_set(fb, v);
-	    fp2_set(fbdenom, vdenom);
+	    mont_set(t0->a, u, m);
+	    mont_set(t0->b, s[k].Qx->b, m);
+	    fp2m_mul(s[k].v, s[k].v, t0, m);
 	}
+	//h is 1
     }
+}
 
-    //work out f_2^a
-    for(; i<a; i++) {
-	fp2_sqr(v, v, p);
-	fp2_sqr(vdenom, vdenom, p);
-	//g
-	//pts_get_tangent(v, Qhat, Z, z, p);
-	{
-	    fp2_mul_mpz(t0, Q->x, numa[i], p);
-	    fp2_add(t0, t0, Q->y, p);
-	    mpz_add(t0->a, t0->a, numc[i]);
-	    fp2_mul(v, v, t0, p);
+void miller_postprocess(fp2_ptr res, miller_cache_t mc,
+	point_ptr Q, curve_t curve)
+//for primes of the form 2^a +- 2^b +- 1
+//uses proj. coords, assumes P is a point over F_p
+//and that order of group = Solinas prime
+//works in Montgomery form
+//there is a single accumulator: instead of dividing by a vertical
+//x - c (c in F_p), we multiply by its conjugate, as their product
+//lies in F_p and is killed by the final exponentiation
+//so res is only correct up to a factor in F_p
+//when Q = Phi(Q') for Q' over F_p, Qy lies in F_p, so each tangent
+//(u + Bi, where Qx = X + Bi) and the conjugated vertical after it
+//(u1 - Bi) are multiplied together sparsely before they meet v
+{
+    struct miller_lane_s s[1];
+
+    miller_lane_init(s, Q, curve->mont);
+    miller_postprocess_lanes(s, 1, mc, curve);
+    fp2m_get_fp2(res, s->v, curve->mont);
+}
+
+void tate_postprocess(fp2_ptr res, miller_cache_t mc, point_ptr Q, curve_t curve)
+{
+    bm_put(bm_get_time(), "miller0");
+    miller_postprocess(res, mc, Q, curve);
+    bm_put(bm_get_time(), "miller1");
+    tate_power(res, curve);
+}
+
+static void mlanes_entry(uint64_t *x, uint64_t *tab, int e, mlanes_ptr L)
+//every element of x = entry e of a table converted by mlanes_set_mont,
+//mlanes_n entries to a vector
+{
+    mlanes_spread(x, tab + (e / mlanes_n) * L->size, e % mlanes_n, L);
+}
+
+static void tate_postprocess_mlanes(fp2_t *res, miller_cache_t mc,
+	point_ptr *Q, int n, curve_t curve)
+//tate_postprocess_batch for points Q[k] whose y-coordinates lie in F_p
+//miller_postprocess_lanes (sparse steps only) and tate_power_array
+//on mlanes_n points at a time, then the (p + 1)/q power with the
+//recoding curve_init made for point_mul_cofactor
+{
+    mlanes_ptr L = curve->lanes;
+    mont_ptr m = curve->mont;
+    int S = L->size;
+    int a = abs(curve->solinasa), b = abs(curve->solinasb);
+    int E = 3 * a + 6; //table entries
+    int e = windowsizepower + 1; //odd powers for the exponentiation
+    int *step = curve->p1onq_step;
+    mp_srcptr *src;
+    mp_limb_t qx[mlanes_n][mont_maxlimbs], qb[mlanes_n][mont_maxlimbs];
+    mp_limb_t qy[mlanes_n][mont_maxlimbs], nrm[mlanes_n * mont_maxlimbs];
+    mp_srcptr px[mlanes_n], pb[mlanes_n], py[mlanes_n];
+    mp_ptr pa[mlanes_n], pn[mlanes_n];
+    fp2m_t r[mlanes_n];
+    uint64_t *tab, *X, *B, *cB, *Y, *B2, *v, *fb, *t, *u, *u1, *d, *g;
+    int i, j, k, l, count;
+
+    tab = (uint64_t *) malloc(sizeof(uint64_t) * S
+	    * ((E + mlanes_n - 1) / mlanes_n + 15 + 2 * e));
+    X = tab + (E + mlanes_n - 1) / mlanes_n * S;
+    B = X + S;
+    cB = B + S;
+    Y = cB + S;
+    B2 = Y + S;
+    u = B2 + S;
+    u1 = u + S;
+    d = u1 + S;
+    v = d + S;
+    fb = v + 2 * S;
+    t = fb + 2 * S;
+    g = t + 2 * S;
+
+    //the table, mlanes_n entries at a time
+    src = (mp_srcptr *) malloc(sizeof(mp_srcptr) * E);
+    for (i=0; i<a; i++) {
+	src[3 * i] = mc->numb + i * m->n;
+	src[3 * i + 1] = mc->numc + i * m->n;
+	src[3 * i + 2] = mc->denomc + i * m->n;
+    }
+    src[3 * a] = mc->denomsb;
+    src[3 * a + 1] = mc->numl1a;
+    src[3 * a + 2] = mc->numl1c;
+    src[3 * a + 3] = mc->denoml1c;
+    src[3 * a + 4] = mc->denoms1;
+    src[3 * a + 5] = mc->numl2c;
+    for (i=0; i<E; i+=mlanes_n) {
+	mlanes_set_mont(tab + i / mlanes_n * S, src + i,
+		E - i < mlanes_n ? E - i : mlanes_n, L);
+    }
+    free(src);
+
+    for (l=0; l<mlanes_n; l++) {
+	px[l] = qx[l];
+	pb[l] = qb[l];
+	py[l] = qy[l];
+	pa[l] = r[l]->a;
+	pn[l] = nrm + l * m->n;
+    }
+
+    for (k=0; k<n; k+=mlanes_n) {
+	count = n - k < mlanes_n ? n - k : mlanes_n;
+	//Qx = X + Bi, Qy = Y
+	for (l=0; l<count; l++) {
+	    mont_set_mpz(qx[l], Q[k + l]->x->a, m);
+	    mont_set_mpz(qb[l], Q[k + l]->x->b, m);
+	    mont_set_mpz(qy[l], Q[k + l]->y->a, m);
 	}
-	//h
-	//pts_get_vertical(vdenom, Qhat, Z, z, p);
-	{
-	    fp2_set(t0, Q->x);
-	    mpz_add(t0->a, t0->a, denomc[i]);
-	    fp2_mul(vdenom, vdenom, t0, p);
+	mlanes_set_mont(X, px, count, L);
+	mlanes_set_mont(B, pb, count, L);
+	mlanes_set_mont(Y, py, count, L);
+	memset(cB, 0, sizeof(uint64_t) * S);
+	mlanes_sub(cB, cB, B, L);
+	mlanes_mul(B2, B, B, L);
+
+	bm_put(bm_get_time(), "miller0");
+	mlanes_set_1(v, L);
+	mlanes_sub(v + S, v, v, L);
+	for (i=0; i<a; i++) {
+	    if (b != 0 && i == b) {
+		if (curve->solinasb < 0) {
+		    //fb = 1/(f_2^b times the vertical at 2^b P)
+		    mlanes_fp2_conj(fb, v, L);
+		    mlanes_entry(t, tab, 3 * a, L);
+		    mlanes_add(t, t, X, L);
+		    memcpy(t + S, cB, sizeof(uint64_t) * S);
+		    mlanes_fp2_mul(fb, fb, t, L);
+		} else {
+		    memcpy(fb, v, sizeof(uint64_t) * 2 * S);
+		}
+	    }
+	    mlanes_fp2_sqr(v, v, L);
+	    //g h = (u + Bi)(u1 - Bi), as miller_mul_line_pair
+	    mlanes_entry(d, tab, 3 * i, L);
+	    mlanes_mul(u, Y, d, L);
+	    mlanes_entry(d, tab, 3 * i + 1, L);
+	    mlanes_add(u, u, d, L);
+	    mlanes_add(u, u, X, L);
+	    mlanes_entry(d, tab, 3 * i + 2, L);
+	    mlanes_add(u1, X, d, L);
+	    mlanes_mul(t, u, u1, L);
+	    mlanes_add(t, t, B2, L);
+	    mlanes_sub(d, u1, u, L);
+	    mlanes_mul(t + S, B, d, L);
+	    mlanes_fp2_mul(v, v, t, L);
 	}
-    }
 
-    //work out f_(2^a +- 2^b +- 1)
-    if (b != 0) {
-	fp2_mul(v, v, fb, p);
-	fp2_mul(vdenom, vdenom, fbdenom, p);
-	//g
-	//tate_get_line(v, Qhat, Z, bP, p);
-	{
-	    fp2_mul_mpz(t0, Q->x, mc->numl1a, p);
-	    fp2_add(t0, t0, Q->y, p);
-	    mpz_add(t0->a, t0->a, mc->numl1c);
-	    fp2_mul(v, v, t0, p);
+	//work out f_(2^a +- 2^b +- 1)
+	if (b != 0) {
+	    mlanes_fp2_mul(v, v, fb, L);
+	    //g
+	    mlanes_entry(d, tab, 3 * a + 1, L);
+	    mlanes_mul(t, X, d, L);
+	    mlanes_mul(t + S, B, d, L);
+	    mlanes_add(t, t, Y, L);
+	    mlanes_entry(d, tab, 3 * a + 2, L);
+	    mlanes_add(t, t, d, L);
+	    mlanes_fp2_mul(v, v, t, L);
+	    //h
+	    mlanes_entry(d, tab, 3 * a + 3, L);
+	    mlanes_add(t, X, d, L);
+	    memcpy(t + S, cB, sizeof(uint64_t) * S);
+	    mlanes_fp2_mul(v, v, t, L);
 	}
-	//h
-	//tate_get_vertical(vdenom, Qhat, Z, p);
-	{
-	    fp2_set(t0, Q->x);
-	    mpz_add(t0->a, t0->a, mc->denoml1c);
-	    fp2_mul(vdenom, vdenom, t0, p);
+	mlanes_entry(d, tab, 3 * a + 5, L);
+	mlanes_add(u, X, d, L);
+	if (curve->solinasa < 0) {
+	    mlanes_entry(d, tab, 3 * a + 4, L);
+	    mlanes_add(u1, X, d, L);
+	    mlanes_mul(t, u, u1, L);
+	    mlanes_add(t, t, B2, L);
+	    mlanes_sub(d, u1, u, L);
+	    mlanes_mul(t + S, B, d, L);
+	} else {
+	    memcpy(t, u, sizeof(uint64_t) * S);
+	    memcpy(t + S, B, sizeof(uint64_t) * S);
 	}
-    }
-
-    if (curve->solinasa < 0) {
-    //the sign of solinasa records whether it's +1 or -1
-	//tate_get_vertical(vdenom, Qhat, P);
-	{
-	    fp2_set(t0, Q->x);
-	    mpz_add(t0->a, t0->a, mc->denoms1);
-	    fp2_mul(vdenom, vdenom, t0, p);
+	mlanes_fp2_mul(v, v, t, L);
+	bm_put(bm_get_time(), "miller1");
+
+	//v^(p - 1) = conj(v)^2 / (a^2 + b^2), as tate_power_array
+	mlanes_mul(u, v, v, L);
+	mlanes_mul(u1, v + S, v + S, L);
+	mlanes_add(u, u, u1, L);
+	mlanes_get_mont(pn, u, count, L);
+	mont_batch_inv(nrm, nrm, count, m);
+	mlanes_set_mont(u, (mp_srcptr *) pn, count, L);
+	mlanes_fp2_conj(g, v, L);
+	mlanes_fp2_sqr(g, g, L);
+	mlanes_mul(g, g, u, L);
+	mlanes_mul(g + S, g + S, u, L);
+
+	//then the (p + 1)/q power, with g + 2jS = g^(2j + 1)
+	mlanes_fp2_sqr_unitary(t, g, L);
+	for (j=1; j<e; j++) {
+	    mlanes_fp2_mul(g + 2 * j * S, g + 2 * (j - 1) * S, t, L);
+	}
+	j = step[0];
+	if (j < 0) {
+	    mlanes_fp2_conj(v, g + 2 * ((-j) >> 1) * S, L);
+	} else {
+	    memcpy(v, g + 2 * (j >> 1) * S, sizeof(uint64_t) * 2 * S);
+	}
+	for (i=1; i<curve->p1onq_steps; i+=2) {
+	    for (j=0; j<step[i]; j++) mlanes_fp2_sqr_unitary(v, v, L);
+	    j = step[i + 1];
+	    if (j < 0) {
+		mlanes_fp2_conj(t, g + 2 * ((-j) >> 1) * S, L);
+		mlanes_fp2_mul(v, v, t, L);
+	    } else if (j > 0) {
+		mlanes_fp2_mul(v, v, g + 2 * (j >> 1) * S, L);
+	    }
 	}
-    }
 
-    //g
-    //tate_get_line(v, Qhat, Z, cP);
-    {
-	fp2_set(t0, Q->x);
-	mpz_add(t0->a, t0->a, mc->numl2c);
-	fp2_mul(v, v, t0, p);
+	for (l=0; l<count; l++) pa[l] = r[l]->a;
+	mlanes_get_mont(pa, v, count, L);
+	for (l=0; l<count; l++) pa[l] = r[l]->b;
+	mlanes_get_mont(pa, v + S, count, L);
+	for (l=0; l<count; l++) {
+	    fp2m_get_fp2(res[k + l], r[l], m);
+	}
     }
-    //h
-    //tate_get_vertical(vdenom, Qhat, Z);
-    fp2_div(res, v, vdenom, p);
 
-    fp2_clear(v);
-    fp2_clear(vdenom);
-    fp2_clear(fb);
-    fp2_clear(fbdenom);
-    fp2_clear(t0);
+    free(tab);
 }
 
-void tate_postprocess(fp2_ptr res, miller_cache_t mc, point_ptr Q, curve_t curve)
+void tate_postprocess_batch(fp2_t *res, miller_cache_t mc, point_ptr *Q,
+	int n, curve_t curve)
 {
-    bm_put(bm_get_time(), "miller0");
-    miller_postprocess(res, mc, Q, curve);
-    bm_put(bm_get_time(), "miller1");
-    tate_power(res, curve);
+    struct miller_lane_s s[miller_batch_chunk];
+    fp2m_t x[miller_batch_chunk];
+    mont_ptr m = curve->mont;
+    int i, k, count;
+
+    if (n <= 0) return;
+    if (curve->lanes_ok) {
+	for (i=0; i<n && !mpz_sgn(Q[i]->y->b); i++);
+	if (i == n) {
+	    tate_postprocess_mlanes(res, mc, Q, n, curve);
+	    return;
+	}
+    }
+    count = n < miller_batch_chunk ? n : miller_batch_chunk;
+
+    for (i=0; i<n; i+=count) {
+	if (count > n - i) count = n - i;
+	for (k=0; k<count; k++) {
+	    miller_lane_init(s + k, Q[i + k], m);
+	}
+	bm_put(bm_get_time(), "miller0");
+	miller_postprocess_lanes(s, count, mc, curve);
+	bm_put(bm_get_time(), "miller1");
+	for (k=0; k<count; k++) {
+	    fp2m_set(x[k], s[k].v, m);
+	}
+	tate_power_array(x, count, curve);
+	for (k=0; k<count; k++) {
+	    fp2m_get_fp2(res[i + k], x[k], m);
+	}
+    }
 }
 
-void tate_solinas_miller(fp2_ptr res, point_ptr P, point_ptr Qhat, curve_t curve)
+struct miller_pair_s {
+    //state for one pair (P, Qhat) in tate_solinas_miller_product
+    mp_limb_t x[mont_maxlimbs], y[mont_maxlimbs], z[mont_maxlimbs];
+    fp2m_t Qx, Qy;
+    fp2m_t cQx; //conjugate of Qx, for the verticals
+    point_t cQ;
+    point_t Z, bP;
+};
+
+static void tate_solinas_miller_product(fp2_ptr res,
+	point_ptr *P, point_ptr *Qhat, int n, curve_t curve)
+//res = product of the Miller functions f_P[k](Qhat[k]), 0 <= k < n,
+//up to a factor in F_p (see miller_postprocess)
 //for primes of the form 2^a +- 2^b +- 1
-//uses proj. coords, assumes P is a point over F_p
+//uses proj. coords, assumes each P[k] is a point over F_p
 //and that order of group = Solinas prime
+//the loops over the bits of q are shared: each step squares the
+//accumulator once, then multiplies in the lines for every pair
+//the doubling loops run in Montgomery form
 {
     //specialized for Solinas primes
     int a, b;
-    fp2_t fb, fbdenom;
-    point_t bP;
+    fp2_ptr fb;
 
-    fp2_t vdenom, v;
-    point_t Z;
-    int i;
-    mpz_t z, temp;
+    fp2_ptr v;
+    int i, k;
     mpz_ptr p = curve->p;
-
-    mpz_init(z);
-    mpz_init(temp);
-    mpz_set_ui(z, 1);
+    mont_ptr m = curve->mont;
+    fp2m_t mv;
+    struct miller_pair_s *s;
 
     a = abs(curve->solinasa);
     b = abs(curve->solinasb);
 
-    point_init(Z);
-    point_init(bP);
-    fp2_init(vdenom);
-    fp2_init(v);
-    fp2_init(fb);
-    fp2_init(fbdenom);
+    s = (struct miller_pair_s *) malloc(sizeof(struct miller_pair_s) * n);
+    v = fp2_scratch_get();
+    fb = fp2_scratch_get();
 
-    fp2_set_1(v);
-    fp2_set_1(vdenom);
+    fp2m_set_1(mv, m);
 
     //f_1 = 1
 
-    point_set(Z, P);
+    for (k=0; k<n; k++) {
+	point_init(s[k].Z);
+	point_init(s[k].bP);
+	point_init(s[k].cQ);
+	fp2_conj(s[k].cQ->x, Qhat[k]->x, p);
+	fp2m_set_fp2(s[k].Qx, Qhat[k]->x, m);
+	fp2m_set_fp2(s[k].Qy, Qhat[k]->y, m);
+	fp2m_conj(s[k].cQx, s[k].Qx, m);
+	point_set(s[k].Z, P[k]);
+	mont_set_mpz(s[k].x, P[k]->x->a, m);
+	mont_set_mpz(s[k].y, P[k]->y->a, m);
+	mont_set_1(s[k].z, m);
+    }
     i = 0;
     if (b != 0) {
 	//work out f_2^b
 	for(;i<b; i++) {
-	    fp2_sqr(v, v, p);
-	    fp2_sqr(vdenom, vdenom, p);
-	    //g
-	    //tate_get_tangent(v, Qhat, Z);
-	    pts_get_tangent(v, Qhat, Z, z, p);
-	    //h
-	    //point_add(Z, Z, Z, curve);
-	    proj_double(Z->x->a, Z->y->a, z, p);
-	    //tate_get_vertical(vdenom, Qhat, Z);
-	    pts_get_vertical(vdenom, Qhat, Z, z, p);
+	    fp2m_sqr(mv, mv, m);
+	    for (k=0; k<n; k++) {
+		//g
+		//tate_get_tangent(v, Qhat, Z);
+		pts_get_tangent(mv, s[k].Qx, s[k].Qy,
+			s[k].x, s[k].y, s[k].z, m);
+		//h
+		//point_add(Z, Z, Z, curve);
+		mproj_double(s[k].x, s[k].y, s[k].z, m);
+		//tate_get_vertical(vdenom, Qhat, Z);
+		pts_get_vertical(mv, s[k].cQx, s[k].x, s[k].z, m);
+	    }
 	}
 
-	mpz_invert(z, z, p);
-	zp_mul(temp, z, z, p);
-	fp2_mul_mpz(Z->x, Z->x, temp, p);
-	zp_mul(temp, temp, z, p);
-	fp2_mul_mpz(Z->y, Z->y, temp, p);
-	mpz_set_ui(z, 1);
-
-	point_set(bP, Z);
-
+	fp2m_get_fp2(v, mv, m);
 	if (curve->solinasb < 0) {
-	    fp2_set(fbdenom, v);
-	    fp2_set(fb, vdenom);
-	    tate_get_vertical(fbdenom, Qhat, Z, p);
-	    fp2_neg(bP->y, bP->y, p);
+	    fp2_conj(fb, v, p);
 	} else {
 	    fp2_set(fb, v);
-	    fp2_set(fbdenom, vdenom);
+	}
+
+	for (k=0; k<n; k++) {
+	    mproj_to_affine(s[k].x, s[k].y, s[k].z, m);
+	    mont_get_mpz(s[k].Z->x->a, s[k].x, m);
+	    mont_get_mpz(s[k].Z->y->a, s[k].y, m);
+
+	    point_set(s[k].bP, s[k].Z);
+
+	    if (curve->solinasb < 0) {
+		tate_get_vertical(fb, s[k].cQ, s[k].Z, p);
+		fp2_neg(s[k].bP->y, s[k].bP->y, p);
+	    }
 	}
     }
 
     //work out f_2^a
     for(; i<a; i++) {
-	fp2_sqr(v, v, p);
-	fp2_sqr(vdenom, vdenom, p);
-	//g
-	pts_get_tangent(v, Qhat, Z, z, p);
-	//h
-	proj_double(Z->x->a, Z->y->a, z, p);
-	pts_get_vertical(vdenom, Qhat, Z, z, p);
+	fp2m_sqr(mv, mv, m);
+	for (k=0; k<n; k++) {
+	    //g
+	    pts_get_tangent(mv, s[k].Qx, s[k].Qy, s[k].x, s[k].y, s[k].z, m);
+	    //h
+	    mproj_double(s[k].x, s[k].y, s[k].z, m);
+	    pts_get_vertical(mv, s[k].cQx, s[k].x, s[k].z, m);
+	}
     }
 
-    mpz_invert(z, z, p);
-    zp_mul(temp, z, z, p);
-    fp2_mul_mpz(Z->x, Z->x, temp, p);
-    zp_mul(temp, temp, z, p);
-    fp2_mul_mpz(Z->y, Z->y, temp, p);
-    mpz_set_ui(z, 1);
+    fp2m_get_fp2(v, mv, m);
 
     //work out f_(2^a +- 2^b +- 1)
     if (b != 0) {
 	fp2_mul(v, v, fb, p);
-	fp2_mul(vdenom, vdenom, fbdenom, p);
+    }
+
+    for (k=0; k<n; k++) {
+	mproj_to_affine(s[k].x, s[k].y, s[k].z, m);
+	mont_get_mpz(s[k].Z->x->a, s[k].x, m);
+	mont_get_mpz(s[k].Z->y->a, s[k].y, m);
+
+	if (b != 0) {
+	    //g
+	    tate_get_line(v, Qhat[k], s[k].Z, s[k].bP, p);
+	    //h
+	    point_add(s[k].Z, s[k].Z, s[k].bP, curve);
+	    tate_get_vertical(v, s[k].cQ, s[k].Z, p);
+	}
+
+	if (curve->solinasa < 0) {
+	//the sign of solinasa records whether it's +1 or -1
+	    tate_get_vertical(v, s[k].cQ, P[k], p);
+	}
+
 	//g
-	tate_get_line(v, Qhat, Z, bP, p);
+	tate_get_vertical(v, Qhat[k], s[k].Z, p);
 	//h
-	point_add(Z, Z, bP, curve);
-	tate_get_vertical(vdenom, Qhat, Z, p);
-    }
 
-    if (curve->solinasa < 0) {
-    //the sign of solinasa records whether it's +1 or -1
-	tate_get_vertical(vdenom, Qhat, P, p);
+	point_clear(s[k].Z);
+	point_clear(s[k].bP);
+	point_clear(s[k].cQ);
     }
 
-    //g
-    tate_get_vertical(v, Qhat, Z, p);
-    //h
-    fp2_div(res, v, vdenom, p);
+    fp2_set(res, v);
 
-    point_clear(Z);
-    point_clear(bP);
-    fp2_clear(v);
-    fp2_clear(vdenom);
-    fp2_clear(fb);
-    fp2_clear(fbdenom);
-    mpz_clear(z);
-    mpz_clear(temp);
+    free(s);
+    fp2_scratch_put(2);
+}
+
+void tate_solinas_miller(fp2_ptr res, point_ptr P, point_ptr Qhat, curve_t curve)
+//for primes of the form 2^a +- 2^b +- 1
+//uses proj. coords, assumes P is a point over F_p
+//and that order of group = Solinas prime
+{
+    tate_solinas_miller_product(res, &P, &Qhat, 1, curve);
 }
 
 int point_valid_p(point_t P, curve_t curve)
 {
     int result = 1;
     mpz_ptr p = curve->p;
-    fp2_t error;
-    fp2_t temp;
+    fp2_ptr error;
+    fp2_ptr temp;
 
     if (P->infinity) return result;
 
-    fp2_init(error);
-    fp2_init(temp);
+    error = fp2_scratch_get();
+    temp = fp2_scratch_get();
     fp2_mul(error, P->x, P->x, p);
     fp2_mul(error, error, P->x, p);
     fp2_mul(temp, P->y, P->y, p);
@@ -1669,8 +2054,7 @@ int point_valid_p(point_t P, curve_t curve)
 	result = 0;
     }
 
-    fp2_clear(error);
-    fp2_clear(temp);
+    fp2_scratch_put(2);
     return result;
 }
 
@@ -1679,16 +2063,16 @@ int point_special_p(point_t P, curve_t curve)
 {
     int result = 1;
     mpz_ptr p = curve->p;
-    mpz_t error;
-    mpz_t temp;
+    mpz_ptr error;
+    mpz_ptr temp;
 
     if (P->infinity) return 0;
 
     if (mpz_cmp_ui(P->x->b, 0)) return 0;
     if (mpz_cmp_ui(P->y->b, 0)) return 0;
 
-    mpz_init(error);
-    mpz_init(temp);
+    error = zp_scratch_get();
+    temp = zp_scratch_get();
     mpz_mul(error, P->x->a, P->x->a);
     mpz_mod(error, error, p);
     mpz_mul(error, error, P->x->a);
@@ -1706,8 +2090,7 @@ int point_special_p(point_t P, curve_t curve)
 	result = 0;
     }
 
-    mpz_clear(error);
-    mpz_clear(temp);
+    fp2_scratch_put(2);
     return result;
 }
 
@@ -1722,6 +2105,58 @@ void tate_pairing(fp2_ptr res, point_ptr P, point_ptr Q, curve_t curve)
     tate_power(res, curve);
 }
 
+void tate_pairing_product(fp2_ptr res, point_ptr *P, point_ptr *Q,
+	int n, curve_t curve)
+//res = e(P[0], Q[0]) ... e(P[n-1], Q[n-1])
+//assume each P[k] in E/F_p
+{
+    tate_product_postprocess(res, NULL, NULL, 0, P, Q, n, curve);
+}
+
+void tate_product_postprocess(fp2_ptr res, miller_cache_ptr *mc, point_ptr *R,
+	int m, point_ptr *P, point_ptr *Q, int n, curve_t curve)
+//res = e(P'[0], R[0]) ... e(P'[m-1], R[m-1]) e(P[0], Q[0]) ... e(P[n-1], Q[n-1])
+//where mc[k] was prepared from P'[k] by tate_preprocess
+//assume each P[k] in E/F_p
+{
+    point_ptr *P1, *Q1;
+    fp2_t f;
+    int i, k;
+    int count = 0;
+
+    fp2_init(f);
+    fp2_set_1(res);
+
+    bm_put(bm_get_time(), "miller0");
+    for (i=0; i<m; i++) {
+	if (R[i]->infinity) continue;
+	miller_postprocess(f, mc[i], R[i], curve);
+	fp2_mul(res, res, f, curve->p);
+	count++;
+    }
+
+    //pairs involving O contribute 1
+    P1 = (point_ptr *) malloc(sizeof(point_ptr) * (2 * n + 1));
+    Q1 = P1 + n;
+    for (i=0, k=0; i<n; i++) {
+	if (P[i]->infinity || Q[i]->infinity) continue;
+	P1[k] = P[i];
+	Q1[k] = Q[i];
+	k++;
+    }
+    if (k) {
+	tate_solinas_miller_product(f, P1, Q1, k, curve);
+	fp2_mul(res, res, f, curve->p);
+	count++;
+    }
+    bm_put(bm_get_time(), "miller1");
+
+    if (count) tate_power(res, curve);
+
+    free(P1);
+    fp2_clear(f);
+}
+
 #if 0
 void weil_pairing(fp2_ptr res, point_ptr P, point_ptr Q)
 // res = e(P,Q) where e is the Weil pairing
@@ -1763,9 +2198,9 @@ void zzp_point_double(mpz_t x, mpz_t y, mpz_t Px, mpz_t Py, mpz_t p)
 {
     //line: Y - (lambda X + mu)
     //we assume a2 = a4 = 0
-    mpz_t lambda, temp;
-    mpz_init(lambda);
-    mpz_init(temp);
+    mpz_ptr lambda, temp;
+    lambda = zp_scratch_get();
+    temp = zp_scratch_get();
 
     mpz_add(lambda, Px, Px);
     mpz_add(lambda, lambda, Px);
@@ -1787,8 +2222,7 @@ void zzp_point_double(mpz_t x, mpz_t y, mpz_t Px, mpz_t Py, mpz_t p)
     mpz_sub(y, y, Py);
     mpz_mod(y, y, p);
 
-    mpz_clear(temp);
-    mpz_clear(lambda);
+    fp2_scratch_put(2);
 }
 
 void zzp_point_add(mpz_t x, mpz_t y, mpz_t Px, mpz_t Py,
@@ -1796,9 +2230,9 @@ void zzp_point_add(mpz_t x, mpz_t y, mpz_t Px, mpz_t Py,
 //(x, y) = (Px, Py) + (Qx, Qy)
 //assume points are on E/F_p, assume output != O
 {
-    mpz_t lambda, temp;
-    mpz_init(lambda);
-    mpz_init(temp);
+    mpz_ptr lambda, temp;
+    lambda = zp_scratch_get();
+    temp = zp_scratch_get();
 
     //line: Y - (lambda X + mu)
     mpz_sub(lambda, Qy, Py);
@@ -1818,246 +2252,774 @@ void zzp_point_add(mpz_t x, mpz_t y, mpz_t Px, mpz_t Py,
     mpz_sub(y, y, Py);
     mpz_mod(y, y, p);
 
-    mpz_clear(temp);
-    mpz_clear(lambda);
+    fp2_scratch_put(2);
 }
 
-void point_mul_preprocess(point_ptr P, curve_t curve)
+void fixed_base_init(fixed_base_t fb, point_ptr P, int width, curve_t curve)
 //get ready for multiplications on P
-//set up signed sliding-windowS
+//entry j c + d - 1 of the table is d 2^(width j) P, where c = 2^(width - 1)
+//and d = 1, ..., c
+//the points are found in projective coordinates and brought
+//to affine with two batch inversions: one for the 2^(width j) P,
+//and one for the rest
 {
-    int i;
-    int m;
+    int i, j, d;
+    int c;
+    int t;
+    mont_ptr mont = curve->mont;
+    int n = mont->n;
+    mp_limb_t x[mont_maxlimbs], y[mont_maxlimbs], t0[mont_maxlimbs];
+    mp_ptr z;
 
     assert(point_special_p(P, curve));
+    assert(width >= 1 && width <= fixed_base_maxwidth);
+
+    c = 1 << (width - 1);
+    //one extra window for the carry out of signed recoding
+    t = (mpz_sizeinbase(curve->q, 2) + width - 1) / width + 1;
+    fb->width = width;
+    fb->windows = t;
+    fb->x = (mp_ptr) malloc(sizeof(mp_limb_t) * n * t * c);
+    fb->y = (mp_ptr) malloc(sizeof(mp_limb_t) * n * t * c);
+    z = (mp_ptr) malloc(sizeof(mp_limb_t) * n * t * c);
+
+    //2^(width j) P
+    mont_set_mpz(x, P->x->a, mont);
+    mont_set_mpz(y, P->y->a, mont);
+    mont_set_1(z, mont);
+    mont_set(fb->x, x, mont);
+    mont_set(fb->y, y, mont);
+    for (j=1; j<t; j++) {
+	mont_set(z + j * n, z + (j - 1) * n, mont);
+	for (i=0; i<width; i++) {
+	    mproj_double(x, y, z + j * n, mont);
+	}
+	mont_set(fb->x + j * c * n, x, mont);
+	mont_set(fb->y + j * c * n, y, mont);
+    }
+
+    mont_batch_inv(z, z, t, mont);
+
+    for (j=1; j<t; j++) {
+	i = j * c * n;
+	mont_sqr(t0, z + j * n, mont);
+	mont_mul(fb->x + i, fb->x + i, t0, mont);
+	mont_mul(t0, t0, z + j * n, mont);
+	mont_mul(fb->y + i, fb->y + i, t0, mont);
+    }
+
+    //the other multiples of each, projectively
+    for (j=0; j<t; j++) {
+	i = j * c * n;
+	mont_set_1(z + i, mont);
+	mont_set(x, fb->x + i, mont);
+	mont_set(y, fb->y + i, mont);
+	mont_set_1(t0, mont);
+	for (d=1; d<c; d++) {
+	    if (d == 1) {
+		mproj_double(x, y, t0, mont);
+	    } else {
+		mproj_mix_in(x, y, t0, fb->x + i, fb->y + i, mont);
+	    }
+	    mont_set(fb->x + i + d * n, x, mont);
+	    mont_set(fb->y + i + d * n, y, mont);
+	    mont_set(z + i + d * n, t0, mont);
+	}
+    }
 
-    m = mpz_sizeinbase(curve->q, 2);
-
-    //compute x[1], y[1]
-    mpz_set(curve->pre_x[0], P->x->a);
-    mpz_set(curve->pre_y[0], P->y->a);
+    mont_batch_inv(z, z, t * c, mont);
 
-    for (i=1; i<=m; i++) {
-	zzp_point_double(curve->pre_x[i], curve->pre_y[i], curve->pre_x[i-1], curve->pre_y[i-1], curve->p);
+    for (j=0; j<t; j++) {
+	for (d=1; d<c; d++) {
+	    i = (j * c + d) * n;
+	    mont_sqr(t0, z + i, mont);
+	    mont_mul(fb->x + i, fb->x + i, t0, mont);
+	    mont_mul(t0, t0, z + i, mont);
+	    mont_mul(fb->y + i, fb->y + i, t0, mont);
+	}
     }
+
+    free(z);
 }
 
-void point_mul_postprocess(point_ptr R, mpz_t n, curve_t curve)
-//R = nP (P has been preprocessed)
-//P must lie on E/F_p, n must be positive
-//assumes nP != O (?)
-//uses signed sliding-window method
+void fixed_base_clear(fixed_base_t fb)
 {
-    //compute NAF form (see Blake, Seroussi & Smart IV.2.4)
-    int j;
-    int m = mpz_sizeinbase(n, 2);
-    int *s = (int *) malloc(sizeof(int) * (m+1));
-    int c0 = 0, c1;
+    free(fb->x);
+    free(fb->y);
+}
 
-    mpz_t Rx, Ry, Rz;
-    mpz_t x0, y0;
-    mpz_ptr p = curve->p;
+void point_mul_postprocess(point_ptr R, mpz_t n, fixed_base_t fb, curve_t curve)
+//R = nP (fb was built for P)
+//n is recoded into signed digits in [-c + 1, c], c = 2^(width - 1),
+//so each window costs at most one addition, and there are no doublings
+//assumes no partial sum is +-(the entry added to it), which
+//only happens with negligible probability
+{
+    int i, j;
+    int c = 1 << (fb->width - 1);
+    int carry = 0;
+    int d;
+    int started = 0;
+    mpz_t m;
+    mont_ptr mont = curve->mont;
+    int k = mont->n;
+    mp_limb_t Rx[mont_maxlimbs], Ry[mont_maxlimbs], Rz[mont_maxlimbs];
+    mp_limb_t y0[mont_maxlimbs];
+    mp_srcptr ex, ey;
+
+    //P has order q
+    mpz_init(m);
+    mpz_mod(m, n, curve->q);
+
+    for (j=0; j<fb->windows; j++) {
+	d = carry;
+	for (i=0; i<fb->width; i++) {
+	    d += (int) mpz_tstbit(m, j * fb->width + i) << i;
+	}
+	if (d > c) {
+	    d -= 1 << fb->width;
+	    carry = 1;
+	} else carry = 0;
 
-    assert(mpz_cmp_ui(n, 0) > 0);
-    assert(mpz_cmp(n, curve->q) < 0);
+	if (!d) continue;
 
-    for (j=0; j<=m; j++) {
-	c1 = (mpz_tstbit(n, j) + mpz_tstbit(n, j+1) + c0) >> 1;
-	s[j] = mpz_tstbit(n, j) + c0 - 2 * c1;
-	c0 = c1;
+	if (d > 0) {
+	    ex = fb->x + (j * c + d - 1) * k;
+	    ey = fb->y + (j * c + d - 1) * k;
+	} else {
+	    ex = fb->x + (j * c - d - 1) * k;
+	    mont_neg(y0, fb->y + (j * c - d - 1) * k, mont);
+	    ey = y0;
+	}
+	if (started) {
+	    mproj_mix_in(Rx, Ry, Rz, ex, ey, mont);
+	} else {
+	    mont_set(Rx, ex, mont);
+	    mont_set(Ry, ey, mont);
+	    mont_set_1(Rz, mont);
+	    started = 1;
+	}
     }
+    mpz_clear(m);
 
-    mpz_init(Rx); mpz_init(Ry); mpz_init(Rz);
-    mpz_init(x0); mpz_init(y0);
+    if (!started) {
+	point_set_O(R);
+	return;
+    }
 
-    //first bit might not be used after NAF conversion
-    if (!s[m]) m--;
+    //convert back to affine
+    mproj_to_affine(Rx, Ry, Rz, mont);
 
-    mpz_set_ui(Rz, 1);
-    //now work in projective coordinates
+    mpz_set_ui(R->x->b, 0);
+    mpz_set_ui(R->y->b, 0);
+    mont_get_mpz(R->x->a, Rx, mont);
+    mont_get_mpz(R->y->a, Ry, mont);
+    R->infinity = 0;
+}
 
-    mpz_set(Rx, curve->pre_x[m]);
-    mpz_set(Ry, curve->pre_y[m]);
+static void point_mul_chunk(point_ptr *R, int *step, int steps,
+	point_ptr *P, int count, curve_t curve)
+//R[i] = nP[i] for the n with point_mul_schedule() = step
+//the odd multiples of all the P[i] are built projectively and brought
+//to affine with two batch inversions, and the results with a third
+//a single point (as for point_mul) needs no heap allocation
+{
+    int i, j, k, d;
+    mont_ptr mont = curve->mont;
+    mp_size_t sz = mont->n;
+    int e = windowsizepower + 1;
+    //odd multiples jP[i] in (mx + (i e + (j >> 1)) sz, my + ...)
+    mp_ptr mx, my, z, x2, y2;
+    mp_limb_t mx1[(windowsizepower + 1) * mont_maxlimbs];
+    mp_limb_t my1[(windowsizepower + 1) * mont_maxlimbs];
+    mp_limb_t z1[(windowsizepower + 1) * mont_maxlimbs];
+    mp_limb_t x21[mont_maxlimbs], y21[mont_maxlimbs];
+    mp_limb_t Rx[mont_maxlimbs], Ry[mont_maxlimbs], Rz[mont_maxlimbs];
+    mp_limb_t y0[mont_maxlimbs];
+    mp_ptr ex, ey;
+
+    if (count <= 0) return;
+    if (count == 1) {
+	mx = mx1;
+	my = my1;
+	z = z1;
+	x2 = x21;
+	y2 = y21;
+    } else {
+	mx = (mp_ptr) malloc(sizeof(mp_limb_t) * count * e * sz);
+	my = (mp_ptr) malloc(sizeof(mp_limb_t) * count * e * sz);
+	z = (mp_ptr) malloc(sizeof(mp_limb_t) * count * e * sz);
+	x2 = (mp_ptr) malloc(sizeof(mp_limb_t) * count * sz);
+	y2 = (mp_ptr) malloc(sizeof(mp_limb_t) * count * sz);
+    }
+
+    //compute 2P[i]
+    for (i=0; i<count; i++) {
+	ex = mx + i * e * sz;
+	ey = my + i * e * sz;
+	mont_set_mpz(ex, P[i]->x->a, mont);
+	mont_set_mpz(ey, P[i]->y->a, mont);
+	mont_set(x2 + i * sz, ex, mont);
+	mont_set(y2 + i * sz, ey, mont);
+	mont_set_1(z + i * sz, mont);
+	mproj_double(x2 + i * sz, y2 + i * sz, z + i * sz, mont);
+    }
+    mont_batch_inv(z, z, count, mont);
+    for (i=0; i<count; i++) {
+	mont_sqr(Rz, z + i * sz, mont);
+	mont_mul(x2 + i * sz, x2 + i * sz, Rz, mont);
+	mont_mul(Rz, Rz, z + i * sz, mont);
+	mont_mul(y2 + i * sz, y2 + i * sz, Rz, mont);
+    }
+
+    //odd multiples jP = P + 2P + ... + 2P are summed projectively
+    for (i=0; i<count; i++) {
+	ex = mx + i * e * sz;
+	ey = my + i * e * sz;
+	mont_set(Rx, ex, mont);
+	mont_set(Ry, ey, mont);
+	mont_set_1(Rz, mont);
+	mont_set_1(z + i * e * sz, mont);
+	for (j=1; j<e; j++) {
+	    mproj_mix_in(Rx, Ry, Rz, x2 + i * sz, y2 + i * sz, mont);
+	    mont_set(ex + j * sz, Rx, mont);
+	    mont_set(ey + j * sz, Ry, mont);
+	    mont_set(z + (i * e + j) * sz, Rz, mont);
+	}
+    }
+    mont_batch_inv(z, z, count * e, mont);
+    for (i=0; i<count * e; i++) {
+	if (!(i % e)) continue;
+	mont_sqr(Rz, z + i * sz, mont);
+	mont_mul(mx + i * sz, mx + i * sz, Rz, mont);
+	mont_mul(Rz, Rz, z + i * sz, mont);
+	mont_mul(my + i * sz, my + i * sz, Rz, mont);
+    }
+
+    //now work in projective coordinates, following the schedule
+    //results go in x2, y2, and z
+    for (i=0; i<count; i++) {
+	ex = mx + i * e * sz;
+	ey = my + i * e * sz;
+	j = step[0];
+	if (j < 0) {
+	    j = -j;
+	    mont_set(Rx, ex + (j >> 1) * sz, mont);
+	    mont_neg(Ry, ey + (j >> 1) * sz, mont);
+	} else {
+	    mont_set(Rx, ex + (j >> 1) * sz, mont);
+	    mont_set(Ry, ey + (j >> 1) * sz, mont);
+	}
+	mont_set_1(Rz, mont);
 
-    m--;
-    while(m>=0) {
-	if (s[m]) {
-	    if (s[m] < 0) {
-		mpz_sub(x0, p, curve->pre_y[m]);
-		proj_mix_in(Rx, Ry, Rz, curve->pre_x[m], x0, p);
-	    } else {
-		proj_mix_in(Rx, Ry, Rz, curve->pre_x[m], curve->pre_y[m], p);
+	for (k=1; k<steps; k+=2) {
+	    for (d=0; d<step[k]; d++) mproj_double(Rx, Ry, Rz, mont);
+	    j = step[k + 1];
+	    if (j < 0) {
+		j = -j;
+		mont_neg(y0, ey + (j >> 1) * sz, mont);
+		mproj_mix_in(Rx, Ry, Rz, ex + (j >> 1) * sz, y0, mont);
+	    } else if (j > 0) {
+		mproj_mix_in(Rx, Ry, Rz, ex + (j >> 1) * sz,
+			ey + (j >> 1) * sz, mont);
 	    }
 	}
-	m--;
+	mont_set(x2 + i * sz, Rx, mont);
+	mont_set(y2 + i * sz, Ry, mont);
+	mont_set(z + i * sz, Rz, mont);
     }
 
     //convert back to affine
-    mpz_invert(Rz, Rz, p);
+    mont_batch_inv(z, z, count, mont);
+    for (i=0; i<count; i++) {
+	//z = 0 when nP[i] = O (e.g. cofactor multiplication of a point
+	//of small order), provided it only happens at the end
+	if (mont_is_0(z + i * sz, mont)) {
+	    point_set_O(R[i]);
+	    continue;
+	}
+	mont_sqr(Rz, z + i * sz, mont);
+	mont_mul(x2 + i * sz, x2 + i * sz, Rz, mont);
+	mont_mul(Rz, Rz, z + i * sz, mont);
+	mont_mul(y2 + i * sz, y2 + i * sz, Rz, mont);
+
+	mpz_set_ui(R[i]->x->b, 0);
+	mpz_set_ui(R[i]->y->b, 0);
+	mont_get_mpz(R[i]->x->a, x2 + i * sz, mont);
+	mont_get_mpz(R[i]->y->a, y2 + i * sz, mont);
+	R[i]->infinity = 0;
+    }
+
+    if (count == 1) return;
+    free(mx);
+    free(my);
+    free(z);
+    free(x2);
+    free(y2);
+}
 
-    mpz_mul(x0, Rz, Rz);
-    mpz_mod(x0, x0, p);
-    mpz_mul(Rx, Rx, x0);
-    mpz_mod(Rx, Rx, p);
-    mpz_mul(y0, x0, Rz);
-    mpz_mod(y0, y0, p);
-    mpz_mul(Ry, Ry, y0);
-    mpz_mod(Ry, Ry, p);
+void point_mul_array(point_ptr *R, mpz_t n, point_ptr *P, int count,
+	curve_t curve)
+//R[i] = nP[i] for 0 <= i < count
+//n is recoded once, and the points are processed in chunks that
+//share their inversions
+//TODO: handle cases when you get O's during the computation
+{
+    int stepbuf[2 * point_mul_stackbits + 3];
+    int *step;
+    int steps;
+    int i, k;
+    int bits = mpz_sizeinbase(n, 2);
+    point_ptr R1[point_mul_chunk_size], P1[point_mul_chunk_size];
 
-    mpz_set_ui(R->x->b, 0);
-    mpz_set_ui(R->y->b, 0);
-    mpz_set(R->x->a, Rx);
-    mpz_set(R->y->a, Ry);
-    R->infinity = 0;
+    assert(mpz_cmp_ui(n, 0) > 0);
 
-    mpz_clear(Rx); mpz_clear(Ry); mpz_clear(Rz);
-    mpz_clear(x0); mpz_clear(y0);
-    free(s);
+    step = bits <= point_mul_stackbits ? stepbuf
+	    : (int *) malloc(sizeof(int) * (2 * bits + 3));
+    steps = point_mul_schedule(step, n);
+
+    //multiples of O are O
+    k = 0;
+    for (i=0; i<count; i++) {
+	if (P[i]->infinity) {
+	    point_set_O(R[i]);
+	    continue;
+	}
+	assert(point_special_p(P[i], curve));
+	R1[k] = R[i];
+	P1[k] = P[i];
+	k++;
+	if (k == point_mul_chunk_size) {
+	    point_mul_chunk(R1, step, steps, P1, k, curve);
+	    k = 0;
+	}
+    }
+    if (k) point_mul_chunk(R1, step, steps, P1, k, curve);
+
+    if (step != stepbuf) free(step);
 }
 
 void point_mul(point_ptr R, mpz_t n, point_ptr P, curve_t curve)
 //R = nP
 //P must lie on E/F_p, 0 < n
 //uses signed sliding-window method
-//TODO: handle cases when you get O's during the computation
 {
-    //compute NAF form (see Blake, Seroussi & Smart IV.2.4)
-    int i, j, k, l;
-    int m = mpz_sizeinbase(n, 2);
-    int *s = (int *) malloc(sizeof(int) * (m+1));
-    int c0 = 0, c1;
-
-    mpz_t x[2*windowsizepower+2];
-    mpz_t y[2*windowsizepower+2];
-    mpz_t Rx, Ry, Rz;
-    mpz_ptr p = curve->p;
+    point_mul_array(&R, n, &P, 1, curve);
+}
 
-    assert(mpz_cmp_ui(n, 0) > 0);
-    assert(point_special_p(P, curve));
+static void point_mul_slow(point_ptr R, mpz_t n, point_ptr P, curve_t curve)
+//R = nP by double-and-add in affine coordinates, for the points
+//of small order the other routines cannot handle
+{
+    point_t T;
+    int i;
 
-    for (j=0; j<=m; j++) {
-	c1 = (mpz_tstbit(n, j) + mpz_tstbit(n, j+1) + c0) >> 1;
-	s[j] = mpz_tstbit(n, j) + c0 - 2 * c1;
-	c0 = c1;
+    point_init(T);
+    point_set_O(T);
+    for (i=mpz_sizeinbase(n, 2)-1; i>=0; i--) {
+	point_add(T, T, T, curve);
+	if (mpz_tstbit(n, i)) point_add(T, T, P, curve);
     }
+    point_set(R, T);
+    point_clear(T);
+}
 
-    mpz_init(Rx); mpz_init(Ry); mpz_init(Rz);
-
-    if (0) {
-	if (mpz_size(P->x->b) || mpz_size(P->y->b) || n <= 0) {
-	    fprintf(stderr, "BUG: point_mul can't handle points not on E/F_p\n");
-	    //exit(1);
+static int mproj_mul_cofactor(mp_ptr x, mp_ptr y, mp_ptr z,
+	point_ptr P, curve_t curve)
+//(x, y, z) = ((p + 1)/q)P, using the recoding from curve_init()
+//P is affine, and no inversions are needed (see Longa & Miri,
+//"New composite operations and precomputation scheme for elliptic
+//curve cryptosystems over prime fields"):
+//we move to the isomorphic curve y^2 = x^3 + z^6 where 2P has z = 1
+//(the doubling and addition formulas do not involve the constant),
+//where a chain of co-Z additions gives the odd multiples of P with
+//a common z, and we move again so that they all have z = 1
+//returns 0 if P has small order, which breaks the chain
+{
+    mont_ptr mont = curve->mont;
+    mp_size_t sz = mont->n;
+    int *step = curve->p1onq_step;
+    int i, j, k, d;
+    int e = windowsizepower + 1;
+    //odd multiples jP in (mx + (j >> 1) sz, my + ...)
+    mp_limb_t mx[(windowsizepower + 1) * mont_maxlimbs];
+    mp_limb_t my[(windowsizepower + 1) * mont_maxlimbs];
+    mp_limb_t l[windowsizepower * mont_maxlimbs];
+    mp_limb_t x2[mont_maxlimbs], y2[mont_maxlimbs], z2[mont_maxlimbs];
+    mp_limb_t r[mont_maxlimbs], t[mont_maxlimbs], y0[mont_maxlimbs];
+
+    //2P = (x2, y2, z2)
+    mont_set_mpz(x2, P->x->a, mont);
+    mont_set_mpz(y2, P->y->a, mont);
+    mont_set_1(z2, mont);
+    mproj_double(x2, y2, z2, mont);
+    if (mont_is_0(z2, mont)) return 0;
+
+    //on the first isomorphic curve, P = (x z2^2, y z2^3, 1)
+    mont_sqr(t, z2, mont);
+    mont_set_mpz(mx, P->x->a, mont);
+    mont_mul(mx, mx, t, mont);
+    mont_mul(t, t, z2, mont);
+    mont_set_mpz(my, P->y->a, mont);
+    mont_mul(my, my, t, mont);
+
+    //(j + 2)P = jP + 2P, and 2P is brought to the z of (j + 2)P
+    //the z of jP is l_0 ... l_(j/2 - 1)
+    for (i=1; i<e; i++) {
+	mont_set(mx + i * sz, mx + (i - 1) * sz, mont);
+	mont_set(my + i * sz, my + (i - 1) * sz, mont);
+	mproj_zaddu(x2, y2, mx + i * sz, my + i * sz, l + (i - 1) * sz, mont);
+	if (mont_is_0(l + (i - 1) * sz, mont)) return 0;
+    }
+
+    //bring the earlier multiples to the last z, which r ends up as
+    mont_set_1(r, mont);
+    for (i=e-2; i>=0; i--) {
+	mont_mul(r, r, l + i * sz, mont);
+	mont_sqr(t, r, mont);
+	mont_mul(mx + i * sz, mx + i * sz, t, mont);
+	mont_mul(t, t, r, mont);
+	mont_mul(my + i * sz, my + i * sz, t, mont);
+    }
+
+    //on the second isomorphic curve the multiples are affine
+    j = step[0];
+    if (j < 0) {
+	j = -j;
+	mont_set(x, mx + (j >> 1) * sz, mont);
+	mont_neg(y, my + (j >> 1) * sz, mont);
+    } else {
+	mont_set(x, mx + (j >> 1) * sz, mont);
+	mont_set(y, my + (j >> 1) * sz, mont);
+    }
+    mont_set_1(z, mont);
+
+    for (k=1; k<curve->p1onq_steps; k+=2) {
+	for (d=0; d<step[k]; d++) mproj_double(x, y, z, mont);
+	j = step[k + 1];
+	if (j < 0) {
+	    j = -j;
+	    mont_neg(y0, my + (j >> 1) * sz, mont);
+	    mproj_mix_in(x, y, z, mx + (j >> 1) * sz, y0, mont);
+	} else if (j > 0) {
+	    mproj_mix_in(x, y, z, mx + (j >> 1) * sz, my + (j >> 1) * sz, mont);
 	}
     }
 
-    mpz_init(y[0]); //we need a temp. variable later
+    //back on our curve, z is scaled by z2 r
+    mont_mul(z, z, z2, mont);
+    mont_mul(z, z, r, mont);
+    return 1;
+}
 
-    //compute x[1], y[1]
-    mpz_init(x[1]);
-    mpz_init(y[1]);
-    mpz_set(x[1], P->x->a);
-    mpz_set(y[1], P->y->a);
+void point_mul_cofactor_array(point_ptr *R, point_ptr *P, int count,
+	curve_t curve)
+//R[i] = ((p + 1)/q)P[i] for 0 <= i < count
+//each result is computed projectively, and each chunk of them is
+//normalized with a single batch inversion
+{
+    mont_ptr mont = curve->mont;
+    mp_size_t sz = mont->n;
+    mp_limb_t x[point_mul_chunk_size * mont_maxlimbs];
+    mp_limb_t y[point_mul_chunk_size * mont_maxlimbs];
+    mp_limb_t z[point_mul_chunk_size * mont_maxlimbs];
+    mp_limb_t t[mont_maxlimbs];
+    int done[point_mul_chunk_size];
+    int i, k, n;
+
+    for (i=0; i<count; i+=n) {
+	n = count - i;
+	if (n > point_mul_chunk_size) n = point_mul_chunk_size;
+
+	for (k=0; k<n; k++) {
+	    done[k] = 1;
+	    if (P[i + k]->infinity) {
+		point_set_O(R[i + k]);
+	    } else if (!mproj_mul_cofactor(x + k * sz, y + k * sz, z + k * sz,
+			P[i + k], curve)) {
+		//P has small order: do it the slow way
+		point_mul_slow(R[i + k], curve->p1onq, P[i + k], curve);
+	    } else done[k] = 0;
+	    if (done[k]) mont_set_0(z + k * sz, mont);
+	}
 
-    //compute x[2], y[2]
-    mpz_init(x[2]);
-    mpz_init(y[2]);
-    zzp_point_double(x[2], y[2], x[1], y[1], p);
+	mont_batch_inv(z, z, n, mont);
 
-    for (i=1; i<=windowsizepower; i++) {
-	j = 2 * i + 1;
-	k = j - 2;
-	mpz_init(x[j]);
-	mpz_init(y[j]);
-	zzp_point_add(x[j], y[j], x[k], y[k], x[2], y[2], p);
+	for (k=0; k<n; k++) {
+	    if (done[k]) continue;
+	    //z = 0 when the result is O
+	    if (mont_is_0(z + k * sz, mont)) {
+		point_set_O(R[i + k]);
+		continue;
+	    }
+	    mont_sqr(t, z + k * sz, mont);
+	    mont_mul(x + k * sz, x + k * sz, t, mont);
+	    mont_mul(t, t, z + k * sz, mont);
+	    mont_mul(y + k * sz, y + k * sz, t, mont);
+
+	    mpz_set_ui(R[i + k]->x->b, 0);
+	    mpz_set_ui(R[i + k]->y->b, 0);
+	    mont_get_mpz(R[i + k]->x->a, x + k * sz, mont);
+	    mont_get_mpz(R[i + k]->y->a, y + k * sz, mont);
+	    R[i + k]->infinity = 0;
+	}
     }
+}
 
-    //first bit might not be used after NAF conversion
-    if (!s[m]) m--;
+void point_mul_cofactor(point_ptr R, point_ptr P, curve_t curve)
+//R = ((p + 1)/q)P
+{
+    point_mul_cofactor_array(&R, &P, 1, curve);
+}
 
-    mpz_set_ui(Rz, 1);
-    //now work in projective coordinates
+static int pippenger_window(int t)
+//digit size for Pippenger's method on t points: about log t - 2 bits
+{
+    int w = 0;
 
-    l = m - windowsize + 1;
-    if (l < 0) l = 0;
-    for (; l<m; l++) {
-	if (s[l]) break;
+    while (t > 1) {
+	t >>= 1;
+	w++;
     }
-    j = s[l];
-    i = 1;
-    for (k=l+1; k<=m; k++) {
-	i = i << 1;
-	j += s[k] * i;
+    return w > 4 ? w - 2 : 2;
+}
+
+static void straus_mul(mp_ptr Rx, mp_ptr Ry, mp_ptr Rz,
+	mpz_ptr *n, point_ptr *P, int t, curve_t curve)
+//(Rx, Ry, Rz) = n[0] P[0] + ... + n[t-1] P[t-1]
+//(Rx, Ry, Rz) must be O (z = 0) on entry
+//interleaves the w-NAF expansions of the n[i], sharing the doublings
+//the odd multiples of every P[i] are brought to affine together
+//with two batch inversions
+{
+    mont_ptr mont = curve->mont;
+    int k = mont->n;
+    int w = multiwindowsize;
+    int e = 1 << (w - 2); //odd multiples per point
+    int i, j, d, l, len = 0;
+    int **s = (int **) malloc(sizeof(int *) * t);
+    int *slen = (int *) malloc(sizeof(int) * t);
+    mp_ptr tx = (mp_ptr) malloc(sizeof(mp_limb_t) * t * e * k);
+    mp_ptr ty = (mp_ptr) malloc(sizeof(mp_limb_t) * t * e * k);
+    mp_ptr z = (mp_ptr) malloc(sizeof(mp_limb_t) * t * e * k);
+    mp_ptr dx = (mp_ptr) malloc(sizeof(mp_limb_t) * t * k);
+    mp_ptr dy = (mp_ptr) malloc(sizeof(mp_limb_t) * t * k);
+    mp_limb_t x[mont_maxlimbs], y[mont_maxlimbs], t0[mont_maxlimbs];
+    mpz_t m;
+
+    //w-NAF of |n[i]|: odd digits below 2^(w-1) in absolute value,
+    //negated if n[i] < 0
+    mpz_init(m);
+    for (i=0; i<t; i++) {
+	mpz_abs(m, n[i]);
+	s[i] = (int *) malloc(sizeof(int) * (mpz_sizeinbase(m, 2) + 1));
+	l = 0;
+	while (mpz_sgn(m)) {
+	    if (mpz_odd_p(m)) {
+		d = mpz_fdiv_ui(m, 1 << w);
+		if (d >= 1 << (w - 1)) d -= 1 << w;
+		if (d > 0) mpz_sub_ui(m, m, d);
+		else mpz_add_ui(m, m, -d);
+	    } else d = 0;
+	    s[i][l++] = mpz_sgn(n[i]) < 0 ? -d : d;
+	    mpz_tdiv_q_2exp(m, m, 1);
+	}
+	slen[i] = l;
+	if (l > len) len = l;
+    }
+    mpz_clear(m);
+
+    //2 P[i]
+    for (i=0; i<t; i++) {
+	mont_set_mpz(tx + i * e * k, P[i]->x->a, mont);
+	mont_set_mpz(ty + i * e * k, P[i]->y->a, mont);
+	mont_set(dx + i * k, tx + i * e * k, mont);
+	mont_set(dy + i * k, ty + i * e * k, mont);
+	mont_set_1(z + i * k, mont);
+	mproj_double(dx + i * k, dy + i * k, z + i * k, mont);
+    }
+    mont_batch_inv(z, z, t, mont);
+    for (i=0; i<t; i++) {
+	mont_sqr(t0, z + i * k, mont);
+	mont_mul(dx + i * k, dx + i * k, t0, mont);
+	mont_mul(t0, t0, z + i * k, mont);
+	mont_mul(dy + i * k, dy + i * k, t0, mont);
+    }
+
+    //3 P[i], 5 P[i], ...
+    for (i=0; i<t; i++) {
+	mont_set(x, tx + i * e * k, mont);
+	mont_set(y, ty + i * e * k, mont);
+	mont_set_1(t0, mont);
+	mont_set_1(z + i * e * k, mont);
+	for (j=1; j<e; j++) {
+	    mproj_mix_in(x, y, t0, dx + i * k, dy + i * k, mont);
+	    mont_set(tx + (i * e + j) * k, x, mont);
+	    mont_set(ty + (i * e + j) * k, y, mont);
+	    mont_set(z + (i * e + j) * k, t0, mont);
+	}
     }
-    if (j < 0) {
-	j = -j;
-	mpz_set(Rx, x[j]);
-	//assumes y[j] != 0
-	mpz_sub(Ry, p, y[j]);
-    } else {
-	mpz_set(Rx, x[j]);
-	mpz_set(Ry, y[j]);
+    mont_batch_inv(z, z, t * e, mont);
+    for (i=0; i<t * e; i++) {
+	if (!(i % e)) continue;
+	mont_sqr(t0, z + i * k, mont);
+	mont_mul(tx + i * k, tx + i * k, t0, mont);
+	mont_mul(t0, t0, z + i * k, mont);
+	mont_mul(ty + i * k, ty + i * k, t0, mont);
+    }
+
+    for (j=len-1; j>=0; j--) {
+	mproj_double(Rx, Ry, Rz, mont);
+	for (i=0; i<t; i++) {
+	    if (j >= slen[i] || !(d = s[i][j])) continue;
+	    l = (i * e + (abs(d) >> 1)) * k;
+	    if (d > 0) {
+		mproj_add(Rx, Ry, Rz, tx + l, ty + l, NULL, mont);
+	    } else {
+		mont_neg(y, ty + l, mont);
+		mproj_add(Rx, Ry, Rz, tx + l, y, NULL, mont);
+	    }
+	}
     }
 
-    m = l-1;
-
-    while(m>=0) {
+    for (i=0; i<t; i++) free(s[i]);
+    free(s);
+    free(slen);
+    free(tx);
+    free(ty);
+    free(z);
+    free(dx);
+    free(dy);
+}
 
-	if (!s[m]) {
-	    proj_double(Rx, Ry, Rz, p);
-	    m--;
-	} else {
-	    l = m - windowsize + 1;
-	    if (l < 0) l = 0;
-	    for (; l<m; l++) {
-		if (s[l]) break;
-	    }
-	    j = s[l];
-	    proj_double(Rx, Ry, Rz, p);
-	    i = 1;
-	    for (k=l+1; k<=m; k++) {
-		i = i << 1;
-		j += s[k] * i;
-		proj_double(Rx, Ry, Rz, p);
+static void pippenger_mul(mp_ptr Rx, mp_ptr Ry, mp_ptr Rz,
+	mpz_ptr *n, point_ptr *P, int t, int w, curve_t curve)
+//(Rx, Ry, Rz) = n[0] P[0] + ... + n[t-1] P[t-1]
+//(Rx, Ry, Rz) must be O (z = 0) on entry
+//bucket method: the n[i] are split into signed w-bit digits, and
+//for each digit position the P[i] are sorted into buckets by digit
+{
+    mont_ptr mont = curve->mont;
+    int k = mont->n;
+    int c = 1 << (w - 1); //buckets
+    int i, j, d, l, carry;
+    int bits = 0;
+    int len;
+    int *s;
+    mp_ptr px = (mp_ptr) malloc(sizeof(mp_limb_t) * t * k);
+    mp_ptr py = (mp_ptr) malloc(sizeof(mp_limb_t) * t * k);
+    mp_ptr bx = (mp_ptr) malloc(sizeof(mp_limb_t) * c * k);
+    mp_ptr by = (mp_ptr) malloc(sizeof(mp_limb_t) * c * k);
+    mp_ptr bz = (mp_ptr) malloc(sizeof(mp_limb_t) * c * k);
+    mp_limb_t x[mont_maxlimbs], y[mont_maxlimbs], z[mont_maxlimbs];
+    mp_limb_t y0[mont_maxlimbs];
+    mpz_t m;
+
+    for (i=0; i<t; i++) {
+	l = mpz_sizeinbase(n[i], 2);
+	if (l > bits) bits = l;
+    }
+    //one extra digit for the carry out of signed recoding
+    len = (bits + w - 1) / w + 1;
+    s = (int *) malloc(sizeof(int) * t * len);
+
+    mpz_init(m);
+    for (i=0; i<t; i++) {
+	mpz_abs(m, n[i]);
+	carry = 0;
+	for (j=0; j<len; j++) {
+	    d = carry;
+	    for (l=0; l<w; l++) {
+		d += (int) mpz_tstbit(m, j * w + l) << l;
 	    }
-	    if (j < 0) {
-		j = -j;
-		mpz_sub(y[0], p, y[j]);
-		proj_mix_in(Rx, Ry, Rz, x[j], y[0], p);
+	    if (d > c) {
+		d -= 1 << w;
+		carry = 1;
+	    } else carry = 0;
+	    s[i * len + j] = mpz_sgn(n[i]) < 0 ? -d : d;
+	}
+	mont_set_mpz(px + i * k, P[i]->x->a, mont);
+	mont_set_mpz(py + i * k, P[i]->y->a, mont);
+    }
+    mpz_clear(m);
+
+    for (j=len-1; j>=0; j--) {
+	for (l=0; l<w; l++) mproj_double(Rx, Ry, Rz, mont);
+
+	for (l=0; l<c; l++) mont_set_0(bz + l * k, mont);
+	for (i=0; i<t; i++) {
+	    d = s[i * len + j];
+	    if (!d) continue;
+	    l = (abs(d) - 1) * k;
+	    if (d > 0) {
+		mproj_add(bx + l, by + l, bz + l, px + i * k, py + i * k,
+			NULL, mont);
 	    } else {
-		proj_mix_in(Rx, Ry, Rz, x[j], y[j], p);
+		mont_neg(y0, py + i * k, mont);
+		mproj_add(bx + l, by + l, bz + l, px + i * k, y0, NULL, mont);
 	    }
-	    m = l-1;
 	}
-    }
 
-    //convert back to affine
-    mpz_invert(Rz, Rz, p);
-
-    //x[1], y[1] no longer needed
-    mpz_mul(x[1], Rz, Rz);
-    mpz_mod(x[1], x[1], p);
-    mpz_mul(Rx, Rx, x[1]);
-    mpz_mod(Rx, Rx, p);
-    mpz_mul(y[1], x[1], Rz);
-    mpz_mod(y[1], y[1], p);
-    mpz_mul(Ry, Ry, y[1]);
-    mpz_mod(Ry, Ry, p);
-
-    mpz_set_ui(R->x->b, 0);
-    mpz_set_ui(R->y->b, 0);
-    mpz_set(R->x->a, Rx);
-    mpz_set(R->y->a, Ry);
-    R->infinity = 0;
+	//sum of l B_l = B_c + (B_c + B_(c-1)) + ...
+	mont_set_0(z, mont);
+	for (l=c-1; l>=0; l--) {
+	    mproj_add(x, y, z, bx + l * k, by + l * k, bz + l * k, mont);
+	    mproj_add(Rx, Ry, Rz, x, y, z, mont);
+	}
+    }
 
-    mpz_clear(Rx); mpz_clear(Ry); mpz_clear(Rz);
+    free(s);
+    free(px);
+    free(py);
+    free(bx);
+    free(by);
+    free(bz);
+}
 
-    mpz_clear(x[2]); mpz_clear(y[2]);
-    for (i=0; i<=windowsizepower; i++) {
-	j = 2 * i + 1;
-	mpz_clear(x[j]); mpz_clear(y[j]);
+void point_multi_mul(point_ptr R, mpz_t *n, point_ptr *P, int t,
+	curve_t curve)
+//R = n[0] P[0] + ... + n[t-1] P[t-1]
+//Straus' method, or Pippenger's for many points
+{
+    mont_ptr mont = curve->mont;
+    mp_limb_t Rx[mont_maxlimbs], Ry[mont_maxlimbs], Rz[mont_maxlimbs];
+    mpz_ptr *n1;
+    point_ptr *P1;
+    int i, k;
+
+    //terms that are O contribute nothing
+    n1 = (mpz_ptr *) malloc(sizeof(mpz_ptr) * (t + 1));
+    P1 = (point_ptr *) malloc(sizeof(point_ptr) * (t + 1));
+    for (i=0, k=0; i<t; i++) {
+	if (P[i]->infinity || !mpz_sgn(n[i])) continue;
+	assert(point_special_p(P[i], curve));
+	n1[k] = n[i];
+	P1[k] = P[i];
+	k++;
+    }
+
+    mont_set_0(Rx, mont);
+    mont_set_0(Ry, mont);
+    mont_set_0(Rz, mont);
+    if (k && k < pippenger_min) {
+	straus_mul(Rx, Ry, Rz, n1, P1, k, curve);
+    } else if (k) {
+	pippenger_mul(Rx, Ry, Rz, n1, P1, k, pippenger_window(k), curve);
+    }
+
+    if (mont_is_0(Rz, mont)) {
+	point_set_O(R);
+    } else {
+	mproj_to_affine(Rx, Ry, Rz, mont);
+	mpz_set_ui(R->x->b, 0);
+	mpz_set_ui(R->y->b, 0);
+	mont_get_mpz(R->x->a, Rx, mont);
+	mont_get_mpz(R->y->a, Ry, mont);
+	R->infinity = 0;
     }
-    mpz_clear(y[0]);
-    free(s);
+
+    free(n1);
+    free(P1);
 }
 
 void general_point_mul(point_t Q, mpz_t a, point_t P, curve_t curve)
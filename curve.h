@@ -11,6 +11,8 @@ See LICENSE for license
 #define CURVE_H
 
 #include "fp2.h"
+#include "mont.h"
+#include "mont_lanes.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,13 +28,21 @@ struct curve_s {
 // s_a = sign(curve->solinasa), s_b = sign(curve->solinasb)
 //this represents 2^a + s_b*2^b + s_a
 
-    mpz_t *pre_x;
-    mpz_t *pre_y;
+    mont_t mont; //Montgomery arithmetic modulo p
+
+    //signed sliding-window recoding of p1onq
+    int *p1onq_step;
+    int p1onq_steps;
+
+    mlanes_t lanes; //Montgomery arithmetic modulo p, mlanes_n at a time
+    int lanes_ok; //whether it is fast enough for tate_postprocess_batch
 };
 
 typedef struct curve_s curve_t[1];
 
-void curve_init(curve_t curve, mpz_t prime, mpz_t qprime);
+int curve_init(curve_t curve, mpz_t prime, mpz_t qprime);
+//returns 0 (and leaves curve uninitialized) if prime is even
+//or has more than mont_maxbits bits
 
 void curve_clear(curve_t curve);
 
@@ -87,38 +97,117 @@ void weil_pairing(fp2_ptr res, point_ptr P, point_ptr Q);
 void tate_pairing(fp2_ptr res, point_ptr P, point_ptr Q, curve_t curve);
 // res = e(P,Q) where e is the Tate pairing
 
+void tate_pairing_product(fp2_ptr res, point_ptr *P, point_ptr *Q,
+	int n, curve_t curve);
+//res = e(P[0], Q[0]) ... e(P[n-1], Q[n-1])
+//cheaper than n calls to tate_pairing: the Miller loops share their
+//squarings, and there is only one final exponentiation
+
 void point_mul(point_ptr R, mpz_t n, point_ptr P, curve_t curve);
 //R = nP
 //P must lie on E/F_p, n must be positive
 
+void point_mul_array(point_ptr *R, mpz_t n, point_ptr *P, int count,
+	curve_t curve);
+//R[i] = nP[i] for 0 <= i < count
+//for one scalar and many points: cheaper than count calls to point_mul
+//each P[i] must lie on E/F_p (or be O), n must be positive
+//R[i] may be P[i]
+
+void point_mul_cofactor(point_ptr R, point_ptr P, curve_t curve);
+//R = ((p + 1)/q)P, so that R has order q (or is O)
+//P must lie on E/F_p
+//cheaper than point_mul by p1onq: the recoding is done by curve_init,
+//and only R needs an inversion
+void point_mul_cofactor_array(point_ptr *R, point_ptr *P, int count,
+	curve_t curve);
+//R[i] = ((p + 1)/q)P[i] for 0 <= i < count, sharing the inversions
+//R[i] may be P[i]
+
+void point_multi_mul(point_ptr R, mpz_t *n, point_ptr *P, int t,
+	curve_t curve);
+//R = n[0] P[0] + ... + n[t-1] P[t-1]
+//each P[i] must lie on E/F_p and have large order (e.g. q)
+//shares the doublings between the terms, so costs roughly as much as
+//t/3 calls to point_mul, and less per point when t is in the hundreds
+
 void general_point_mul(point_t R, mpz_t n, point_t P, curve_t curve);
 //R = nP
 //can handle P on E/F_p^2, any integer n
 
-void point_mul_preprocess(point_ptr P, curve_t curve);
-void point_mul_postprocess(point_ptr res, mpz_t n, curve_t curve);
+enum {
+    //default window width for fixed_base_init
+    fixed_base_width = 5,
+    fixed_base_maxwidth = 10
+};
+
+//table of multiples of a fixed point of order q, for fast scalar
+//multiplications of that point
+//in Montgomery form, mont->n limbs per entry
+struct fixed_base_s {
+    int width; //window width in bits
+    int windows;
+    mp_limb_t *x, *y;
+};
+
+typedef struct fixed_base_s fixed_base_t[1];
+typedef struct fixed_base_s *fixed_base_ptr;
+
+void fixed_base_init(fixed_base_t fb, point_ptr P, int width, curve_t curve);
+//get ready for multiplications on P, which must have order q
+//the table holds about 2^(width - 1) log q / width points,
+//and a multiplication costs about log q / width point additions
+//so wider windows trade memory (and set up time) for speed
+void fixed_base_clear(fixed_base_t fb);
+void point_mul_postprocess(point_ptr res, mpz_t n, fixed_base_t fb,
+	curve_t curve);
+//res = nP, where fb was built for P
 
 int point_valid_p(point_t P, curve_t curve);
 //returns 1 if P is a valid point on the curve
 //(i.e. its coordinates satisfy the curve equation)
 
+enum {
+    //number of points tate_postprocess_batch works on at once
+    miller_batch_chunk = 8
+};
+
+//coefficients are held in Montgomery form, mont->n limbs per entry
+//the tangents are scaled to x + numb y + numc, and the verticals
+//are x + denomc
 struct miller_cache_s {
-    mpz_t *numa, *numc, *denomc;
-    mpz_t denomsb;
-    mpz_t denoms1;
-    mpz_t numl1a, numl1c, denoml1c;
-    mpz_t numl2c;
+    mp_limb_t *numb, *numc, *denomc;
+    mp_limb_t denomsb[mont_maxlimbs];
+    mp_limb_t denoms1[mont_maxlimbs];
+    mp_limb_t numl1a[mont_maxlimbs], numl1c[mont_maxlimbs];
+    mp_limb_t denoml1c[mont_maxlimbs];
+    mp_limb_t numl2c[mont_maxlimbs];
     int count;
 };
 
 typedef struct miller_cache_s miller_cache_t[1];
+typedef struct miller_cache_s *miller_cache_ptr;
 
 void miller_cache_init(miller_cache_t mc, curve_t curve);
 void miller_cache_clear(miller_cache_t mc);
 
 void tate_preprocess(miller_cache_t mc, point_ptr P, curve_t curve);
 void miller_postprocess(fp2_ptr res, miller_cache_t mc, point_ptr Q, curve_t curve);
+//res = the Miller function of mc at Q, up to a factor in F_p
+//(which does not change the pairing, as tate_power kills it)
 void tate_postprocess(fp2_ptr res, miller_cache_t mc, point_ptr Q, curve_t curve);
+void tate_postprocess_batch(fp2_t *res, miller_cache_t mc, point_ptr *Q,
+	int n, curve_t curve);
+//res[k] = tate_postprocess(mc, Q[k]) for 0 <= k < n
+//the Miller loops run side by side, a table entry at a time, and
+//the final exponentiations share an inversion
+//if the CPU has AVX-512 IFMA and each Q[k] = Phi(Q') for Q' over F_p,
+//mlanes_n points are computed at once by mont_lanes.c
+void tate_product_postprocess(fp2_ptr res, miller_cache_ptr *mc, point_ptr *R,
+	int m, point_ptr *P, point_ptr *Q, int n, curve_t curve);
+//like tate_pairing_product, with m more factors whose first points
+//have been preprocessed: res is the product of the e(P[k], Q[k])
+//and the pairings of the points behind mc[k] with R[k]
 
 int simple_miller(fp2_ptr res, point_ptr P, point_ptr Phat,
 	point_ptr Qhat, point_ptr R1, point_ptr R2, curve_t curve);
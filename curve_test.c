@@ -89,6 +89,16 @@ void test(void)
     fp2_out_str(stdout, 0, r);
     printf("\n");
 
+    {
+	point_ptr L[2], R[2];
+	L[0] = P1; R[0] = Q;
+	L[1] = P2; R[1] = Q;
+	tate_pairing_product(r, L, R, 2, curve);
+	printf("product of pairings = ");
+	fp2_out_str(stdout, 0, r);
+	printf("\n");
+    }
+
     tate_pairing(r, Psum, Q, curve);
     printf("e(P1 + P2, Q) = ");
     fp2_out_str(stdout, 0, r);
@@ -138,6 +148,15 @@ void test(void)
     fp2_pow(r, r4, p1, p);
     fp2_out_str(stdout, 0, r);
     printf("\n");
+
+    //pairing values have norm 1 so fp2_pow_unitary should agree
+    printf("fp2_pow_unitary: ");
+    fp2_pow_unitary(r, r1, p1, p);
+    fp2_out_str(stdout, 0, r);
+    printf(" ");
+    fp2_pow_unitary(r, r1, q, p);
+    fp2_out_str(stdout, 0, r);
+    printf(" should be 1 1\n");
 }
 
 int main(int argc, char **argv)
@@ -169,7 +188,10 @@ int main(int argc, char **argv)
     mpz_set_ui(p1onq, 12);
     mpz_divexact(q, p1, p1onq);
 
-    curve_init(curve, p, q);
+    if (!curve_init(curve, p, q)) {
+	fprintf(stderr, "curve_init failed\n");
+	exit(1);
+    }
 
     point_init(P);
     point_init(P1);
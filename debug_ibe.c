@@ -1,5 +1,6 @@
 /* for testing; extracts a key share given a server's master share
  * (users should never have access to any master share)
+ * or key shares for a whole list of IDs
  * also constructs any private key given
  * the share files (which in real life would never be together in one place)
  * Ben Lynn
@@ -12,6 +13,7 @@ See LICENSE for license
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <openssl/evp.h>
 #include "format.h"
 #include "ibe_progs.h"
@@ -39,6 +41,98 @@ int extract_share(int argc, char **argv)
     return 0;
 }
 
+enum {
+    //IDs read from the list before shares are computed and written out
+    extract_batch_block = 4096,
+    extract_batch_maxline = 1024
+};
+
+int extract_share_batch(int argc, char **argv)
+//like extract_share, but for every ID (one per line) in a file
+//(or standard input), e.g. to reissue all key shares for a new year
+{
+    FILE *infp;
+    char line[extract_batch_maxline];
+    char **addr, **id;
+    byte_string_t mshare;
+    byte_string_t *kshare;
+    int threads = GetIntParam(cnfctx, "threads", 0, 4);
+    int i, n, len, c;
+    int done = 0;
+    int status = 0;
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: extract_share_batch SHAREFILE [IDFILE]\n");
+	return 1;
+    }
+
+    if (FMT_load_byte_string(argv[1], mshare) != 1) {
+	fprintf(stderr, "error loading share file %s\n", argv[1]);
+	return 1;
+    }
+
+    if (argc < 3 || !strcmp(argv[2], "-")) {
+	infp = stdin;
+    } else {
+	infp = fopen(argv[2], "r");
+	if (!infp) {
+	    fprintf(stderr, "error opening %s\n", argv[2]);
+	    byte_string_clear(mshare);
+	    return 1;
+	}
+    }
+
+    addr = (char **) malloc(extract_batch_block * sizeof(char *));
+    id = (char **) malloc(extract_batch_block * sizeof(char *));
+    kshare = (byte_string_t *) malloc(extract_batch_block * sizeof(byte_string_t));
+
+    while (!done) {
+	n = 0;
+	while (n < extract_batch_block) {
+	    if (!fgets(line, extract_batch_maxline, infp)) {
+		done = 1;
+		break;
+	    }
+	    len = strlen(line);
+	    //a line that does not fit would otherwise become two IDs
+	    if (len && line[len - 1] != '\n' && (c = getc(infp)) != EOF && c != '\n') {
+		while (c != EOF && c != '\n') c = getc(infp);
+		fprintf(stderr, "skipping ID longer than %d bytes\n",
+			extract_batch_maxline - 1);
+		status = 1;
+		continue;
+	    }
+	    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		line[--len] = 0;
+	    }
+	    if (!len) continue;
+	    addr[n] = (char *) malloc(len + 1);
+	    strcpy(addr[n], line);
+	    id[n] = FMT_make_id(addr[n], NULL, params);
+	    n++;
+	}
+
+	IBE_extract_share_batch(kshare, mshare, id, n, threads, params);
+
+	for (i=0; i<n; i++) {
+	    printf("ID: %s", addr[i]);
+	    FMT_crypt_save_fp(stdout, kshare[i], "password");
+	    byte_string_clear(kshare[i]);
+	    free(addr[i]);
+	    free(id[i]);
+	}
+	fflush(stdout);
+    }
+
+    if (infp != stdin) fclose(infp);
+    free(addr);
+    free(id);
+    free(kshare);
+    byte_string_clear(mshare);
+
+    return status;
+}
+
 int extract(int argc, char **argv)
 {
     char *id;
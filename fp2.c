@@ -9,12 +9,16 @@ See LICENSE for license
 #include <stdlib.h>
 #include <string.h>
 #include "fp2.h"
+#include "mont.h"
 #include "mm.h"
 
 enum {
     //constants for sliding window algorithms
     windowsize = 5,
-    windowsizepower = 15	    //this is 2^(windowsize - 1) - 1
+    windowsizepower = 15,	    //this is 2^(windowsize - 1) - 1
+    //initial size of each thread's pool of temporaries
+    //(it doubles whenever calls nest deeper than that)
+    scratch_initial = 64
 };
 
 //we represent elements of F_p^2 with
@@ -66,6 +70,64 @@ inline void zp_sub(mpz_t x, mpz_t a, mpz_t b, mpz_t p)
     */
 }
 
+//per-thread pool of temporaries, used as a stack
+//entries keep their limbs between uses so once the pool has warmed up
+//borrowing a temporary costs no heap allocation
+//(and threads do not contend on the allocator)
+//entries are allocated one by one so they stay put when the pool grows
+static __thread fp2_ptr *scratch = NULL;
+static __thread int scratch_size = 0; //length of scratch
+static __thread int scratch_top = 0; //next free entry
+static __thread int scratch_count = 0; //number of initialized entries
+
+fp2_ptr fp2_scratch_get(void)
+//borrow a temporary from this thread's pool
+{
+    fp2_ptr x;
+
+    if (scratch_top == scratch_count) {
+	if (scratch_count == scratch_size) {
+	    scratch_size = scratch_size ? 2 * scratch_size : scratch_initial;
+	    scratch = (fp2_ptr *) realloc(scratch,
+		    sizeof(fp2_ptr) * scratch_size);
+	}
+	x = (fp2_ptr) malloc(sizeof(struct fp2_s));
+	mpz_init(x->a);
+	mpz_init(x->b);
+	scratch[scratch_count++] = x;
+    }
+    return scratch[scratch_top++];
+}
+
+mpz_ptr zp_scratch_get(void)
+//borrow a temporary from this thread's pool
+{
+    return fp2_scratch_get()->a;
+}
+
+void fp2_scratch_put(int n)
+//return the n most recently borrowed temporaries
+{
+    scratch_top -= n;
+}
+
+void fp2_scratch_clear(void)
+//release the memory held by this thread's pool
+{
+    int i;
+
+    for (i=0; i<scratch_count; i++) {
+	mpz_clear(scratch[i]->a);
+	mpz_clear(scratch[i]->b);
+	free(scratch[i]);
+    }
+    free(scratch);
+    scratch = NULL;
+    scratch_size = 0;
+    scratch_count = 0;
+    scratch_top = 0;
+}
+
 void fp2_init(fp2_ptr x)
 //call before using x
 //allocates space for x
@@ -142,9 +204,20 @@ void fp2_init_set(fp2_ptr x, fp2_ptr y)
 
 void fp2_neg(fp2_ptr x, fp2_ptr a, mpz_t p)
 //x = -a
+//(zero stays zero rather than becoming p, so that fp2_equal works)
+{
+    if (mpz_sgn(a->a)) mpz_sub(x->a, p, a->a);
+    else mpz_set_ui(x->a, 0);
+    if (mpz_sgn(a->b)) mpz_sub(x->b, p, a->b);
+    else mpz_set_ui(x->b, 0);
+}
+
+void fp2_conj(fp2_ptr x, fp2_ptr a, mpz_t p)
+//x = conjugate of a
 {
-    mpz_sub(x->a, p, a->a);
-    mpz_sub(x->b, p, a->b);
+    mpz_set(x->a, a->a);
+    if (mpz_sgn(a->b)) mpz_sub(x->b, p, a->b);
+    else mpz_set_ui(x->b, 0);
 }
 
 void fp2_add(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p)
@@ -171,8 +244,8 @@ void fp2_sub_ui(fp2_ptr x, fp2_ptr a, unsigned long b, mpz_t p)
 void fp2_sqr(fp2_ptr x, fp2_ptr a, mpz_t p)
 //x = a * a
 {
-    mpz_t t0, t1; //temp variables
-    mpz_init(t0); mpz_init(t1);
+    mpz_ptr t0, t1; //temp variables
+    t0 = zp_scratch_get(); t1 = zp_scratch_get();
 
     //sqr_mod(t0, a->a);
     //sqr_mod(t1, a->b);
@@ -194,7 +267,7 @@ void fp2_sqr(fp2_ptr x, fp2_ptr a, mpz_t p)
     mpz_mod(x->b, x->b, p);
     mpz_mod(x->a, t0, p);
 
-    mpz_clear(t0); mpz_clear(t1);
+    fp2_scratch_put(2);
 }
 
 void fp2_mul_mpz(fp2_ptr x, fp2_ptr a, mpz_ptr b, mpz_t p)
@@ -207,8 +280,8 @@ void fp2_mul_mpz(fp2_ptr x, fp2_ptr a, mpz_ptr b, mpz_t p)
 void fp2_mul(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p)
 //x = a * b
 {
-    mpz_t t0, t1, t2; //temp variables
-    mpz_init(t0); mpz_init(t1); mpz_init(t2);
+    mpz_ptr t0, t1, t2; //temp variables
+    t0 = zp_scratch_get(); t1 = zp_scratch_get(); t2 = zp_scratch_get();
 
     /* This is slower
     zp_mul(t0, a->a, b->a);
@@ -228,16 +301,14 @@ void fp2_mul(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p)
     mpz_mod(x->b, x->b, p);
     mpz_mod(x->a, t0, p);
 
-    mpz_clear(t0); mpz_clear(t1); mpz_clear(t2);
+    fp2_scratch_put(3);
 }
 
 void fp2_inv(fp2_ptr x, fp2_ptr b, mpz_t p)
 //x = 1 / b
 {
-    mpz_t t0, t1; //temp variables
-    mpz_t t2;
-    mpz_init(t2);
-    mpz_init(t0); mpz_init(t1);
+    mpz_ptr t0, t1; //temp variables
+    t0 = zp_scratch_get(); t1 = zp_scratch_get();
 
     /*
     zp_mul(t0, b->a, b->a);
@@ -260,15 +331,14 @@ void fp2_inv(fp2_ptr x, fp2_ptr b, mpz_t p)
     mpz_mul(x->a, t1, b->a);
     mpz_mod(x->a, x->a, p);
 
-    mpz_clear(t0); mpz_clear(t1);
-    mpz_clear(t2);
+    fp2_scratch_put(2);
 }
 
 void fp2_div(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p)
 //x = a / b
 {
-    mpz_t t0, t1, t2, t3; //temp variables
-    mpz_init(t0); mpz_init(t1); mpz_init(t2); mpz_init(t3);
+    mpz_ptr t0, t1, t2, t3; //temp variables
+    t0 = zp_scratch_get(); t1 = zp_scratch_get(); t2 = zp_scratch_get(); t3 = zp_scratch_get();
 
     /*
     zp_mul(t0, b->a, b->a);
@@ -301,7 +371,92 @@ void fp2_div(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p)
     mpz_mul(x->a, t1, t0);
     mpz_mod(x->a, x->a, p);
 
-    mpz_clear(t0); mpz_clear(t1); mpz_clear(t2); mpz_clear(t3);
+    fp2_scratch_put(4);
+}
+
+void fp_batch_inv(mpz_t *x, mpz_t *a, int n, mpz_t p)
+//x[i] = 1 / a[i] for 0 <= i < n
+//Montgomery's trick: one inversion and 3(n - 1) multiplications
+{
+    mpz_t *pre;
+    mpz_ptr inv, t;
+    int i;
+
+    if (n <= 0) return;
+
+    //pre[i] = a[0] ... a[i-1], skipping zeros
+    //x can hold these unless it is also the input
+    if (x == a) {
+	pre = (mpz_t *) malloc(sizeof(mpz_t) * n);
+	for (i=0; i<n; i++) mpz_init(pre[i]);
+    } else pre = x;
+
+    inv = zp_scratch_get();
+    t = zp_scratch_get();
+
+    mpz_set_ui(inv, 1);
+    for (i=0; i<n; i++) {
+	mpz_set(pre[i], inv);
+	if (mpz_sgn(a[i])) {
+	    if (i) zp_mul(inv, inv, a[i], p);
+	    else mpz_set(inv, a[i]);
+	}
+    }
+
+    mpz_invert(inv, inv, p);
+
+    //now walk back: inv = 1 / (a[0] ... a[i])
+    //zeros are mapped to zero as in mont_inv()
+    for (i=n-1; i>=0; i--) {
+	if (!mpz_sgn(a[i])) {
+	    mpz_set_ui(x[i], 0);
+	    continue;
+	}
+	zp_mul(t, inv, pre[i], p);
+	if (i) zp_mul(inv, inv, a[i], p);
+	mpz_set(x[i], t);
+    }
+
+    fp2_scratch_put(2);
+
+    if (pre != x) {
+	for (i=0; i<n; i++) mpz_clear(pre[i]);
+	free(pre);
+    }
+}
+
+void fp2_batch_inv(fp2_t *x, fp2_t *a, int n, mpz_t p)
+//x[i] = 1 / a[i] for 0 <= i < n
+//1 / (a + bi) = (a - bi) / (a^2 + b^2) so this is
+//fp_batch_inv() on the norms followed by 2n multiplications
+{
+    mpz_t *norm;
+    mpz_ptr t;
+    int i;
+
+    if (n <= 0) return;
+
+    norm = (mpz_t *) malloc(sizeof(mpz_t) * n);
+    t = zp_scratch_get();
+    for (i=0; i<n; i++) {
+	mpz_init(norm[i]);
+	mpz_mul(norm[i], a[i]->a, a[i]->a);
+	mpz_mul(t, a[i]->b, a[i]->b);
+	mpz_add(norm[i], norm[i], t);
+	mpz_mod(norm[i], norm[i], p);
+    }
+
+    fp_batch_inv(norm, norm, n, p);
+
+    for (i=0; i<n; i++) {
+	zp_mul(x[i]->a, a[i]->a, norm[i], p);
+	mpz_mul(t, a[i]->b, norm[i]);
+	mpz_neg(t, t);
+	mpz_mod(x[i]->b, t, p);
+	mpz_clear(norm[i]);
+    }
+    fp2_scratch_put(1);
+    free(norm);
 }
 
 void fp2_pow(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p)
@@ -309,7 +464,18 @@ void fp2_pow(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p)
 //res = x^n
 {
     int i, j, k, l, m;
-    mpz_t t0, t1; //temp variables
+    mpz_ptr t0, t1; //temp variables
+    mont_t mont;
+
+    //use fixed-width Montgomery arithmetic when p allows it
+    if (mont_init(mont, p)) {
+	fp2m_t mx, mres;
+
+	fp2m_set_fp2(mx, x, mont);
+	fp2m_pow(mres, mx, n, mont);
+	fp2m_get_fp2(res, mres, mont);
+	return;
+    }
 
     //use sliding-window method
     fp2_t g[2*windowsizepower+2];
@@ -317,7 +483,7 @@ void fp2_pow(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p)
     fp2_init(g[2]);
     fp2_mul(g[2], x, x, p);
 
-    mpz_init(t0); mpz_init(t1);
+    t0 = zp_scratch_get(); t1 = zp_scratch_get();
 
     for (i=1; i<=windowsizepower; i++) {
 	j = 2 * i + 1;
@@ -378,7 +544,7 @@ void fp2_pow(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p)
 	fp2_clear(g[j]);
     }
 
-    mpz_clear(t0); mpz_clear(t1);
+    fp2_scratch_put(2);
 
     /* simple method:
     int m = mpz_sizeinbase(n, 2) - 1;
@@ -403,6 +569,21 @@ int fp2_is_0(fp2_ptr x)
     return (!(mpz_size(x->a) || mpz_size(x->b)));
 }
 
+void fp2_pow_unitary(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p)
+//res = x^n, x of norm 1
+{
+    mont_t mont;
+    fp2m_t mx, mres;
+
+    if (!mont_init(mont, p)) {
+	fp2_pow(res, x, n, p);
+	return;
+    }
+    fp2m_set_fp2(mx, x, mont);
+    fp2m_pow_unitary(mres, mx, n, mont);
+    fp2m_get_fp2(res, mres, mont);
+}
+
 int fp2_equal(fp2_ptr x, fp2_ptr y)
 // x == y?
 {
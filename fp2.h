@@ -39,6 +39,26 @@ void zp_sub(mpz_t x, mpz_t a, mpz_t b, mpz_t p);
 void zp_mul(mpz_t x, mpz_t a, mpz_t b, mpz_t p);
 //x = a * b mod p
 
+//scratch temporaries:
+//each thread has its own pool of preallocated temporaries
+//which are borrowed and returned in stack order,
+//so routines in the inner loops avoid malloc/free
+//(the pool grows to fit however deeply the calls nest)
+//a thread should call fp2_scratch_clear() before it exits
+
+fp2_ptr fp2_scratch_get(void);
+//borrow a temporary from this thread's pool
+
+mpz_ptr zp_scratch_get(void);
+//borrow a temporary from this thread's pool
+//(occupies a slot just like fp2_scratch_get())
+
+void fp2_scratch_put(int n);
+//return the n most recently borrowed temporaries
+
+void fp2_scratch_clear(void);
+//release the memory held by this thread's pool
+
 void fp2_init(fp2_ptr x);
 //call before using x
 //allocates space for x
@@ -65,6 +85,9 @@ void fp2_init_set(fp2_ptr x, fp2_ptr y);
 void fp2_neg(fp2_ptr x, fp2_ptr a, mpz_t p);
 //x = -a
 
+void fp2_conj(fp2_ptr x, fp2_ptr a, mpz_t p);
+//x = conjugate of a (= a^p)
+
 void fp2_add(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p);
 //x = a + b
 
@@ -89,9 +112,22 @@ void fp2_inv(fp2_ptr x, fp2_ptr b, mpz_t p);
 void fp2_div(fp2_ptr x, fp2_ptr a, fp2_ptr b, mpz_t p);
 //x = a / b
 
+void fp_batch_inv(mpz_t *x, mpz_t *a, int n, mpz_t p);
+//x[i] = 1 / a[i] mod p for 0 <= i < n
+//costs one inversion and 3(n - 1) multiplications
+//zero entries are left as zero, x may equal a
+
+void fp2_batch_inv(fp2_t *x, fp2_t *a, int n, mpz_t p);
+//x[i] = 1 / a[i] for 0 <= i < n
+//costs one inversion, as fp_batch_inv()
+
 void fp2_pow(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p);
 //res = x^n
 
+void fp2_pow_unitary(fp2_ptr res, fp2_ptr x, mpz_t n, mpz_t p);
+//res = x^n where x has norm 1 (e.g. x is a Tate pairing value)
+//faster than fp2_pow, wrong for other x
+
 int fp2_equal(fp2_ptr x, fp2_ptr y);
 //returns true if x equals y, false otherwise
 
@@ -1,7 +1,16 @@
+/* Tests F_p^2 arithmetic
+ * (check by eye that the output is as labelled)
+ * Ben Lynn
+ */
+/*
+Copyright (C) 2001 Benjamin Lynn (blynn@cs.stanford.edu)
 
 See LICENSE for license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "fp2.h"
 
-See LICENSE for license
 static int m = 59;
 
 void fp2_random(fp2_ptr r)
@@ -77,6 +86,32 @@ int main(int argc, char **argv)
     fp2_out_str(NULL, 0, c);
     printf("\n");
 
+    //batch inversion, including a zero entry
+    {
+	fp2_t v[5], w[5];
+	int i;
+
+	for (i=0; i<5; i++) {
+	    fp2_init(v[i]);
+	    fp2_init(w[i]);
+	    fp2_random(v[i]);
+	}
+	fp2_set_0(v[2]);
+	fp2_batch_inv(w, v, 5, p);
+	printf("1 1 0 1 1 = ");
+	for (i=0; i<5; i++) {
+	    fp2_mul(c, w[i], v[i], p);
+	    if (i == 2) fp2_add(c, c, w[i], p);
+	    fp2_out_str(NULL, 0, c);
+	    printf(" ");
+	}
+	printf("\n");
+	for (i=0; i<5; i++) {
+	    fp2_clear(v[i]);
+	    fp2_clear(w[i]);
+	}
+    }
+
     fp2_clear(a);
     fp2_clear(b);
     fp2_clear(c);
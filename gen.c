@@ -77,7 +77,10 @@ int main(int argc, char **argv)
     }
 
     IBE_init();
-    IBE_setup(params, master, bits, qbits, systemid);
+    if (!IBE_setup(params, master, bits, qbits, systemid)) {
+	fprintf(stderr, "cannot generate a %d-bit prime\n", bits);
+	exit(1);
+    }
     byte_string_printf(master, " %02X");
 
     FMT_split_master(sharefile, master, t, n, params);
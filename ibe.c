@@ -75,6 +75,8 @@ int main(int argc, char **argv)
 	imratio(argc, argv);
     } else if (!strcmp(cmd, "params")) {
 	show_params(argc, argv);
+    } else if (!strcmp(cmd, "extract_share_batch")) {
+	extract_share_batch(argc, argv);
     } else if (!strcmp(cmd, "extract_share")) {
 	extract_share(argc, argv);
     } else if (!strcmp(cmd, "extract")) {
@@ -16,6 +16,7 @@ See LICENSE for license
 
 #include "curve.h"
 #include "byte_string.h"
+#include "lru.h"
 
 struct params_s {
     char *id;
@@ -34,13 +35,22 @@ struct params_s {
     mpz_t p1onq;
     fp2_t zeta; //cube root of unity
     point_t PhiPpub;
+    fixed_base_t P_fb; //for multiples of P
+    miller_cache_t P_mc;
     miller_cache_t Ppub_mc;
+
+    //caches
+    lru_t idcache; //ID -> point of order q
+    lru_t gidcache; //ID -> e(Q_id, Phi(P_pub)) and its powers
+    lru_t certcache; //H(public key, ID) -> e(P_pub, Phi(Q_cert))
+    lru_t keycache; //BLS public key -> its Miller table
 };
 
 typedef struct params_s params_t[1];
 
 void IBE_init(void); //initialize library
 void IBE_clear(void); //call when done with library
+void IBE_thread_clear(void); //call before a thread using the library exits
 
 void params_out(FILE *outfp, params_t params); //print system parameters
 void params_clear(params_t params); //call when done with params
@@ -49,9 +59,10 @@ void params_robust_clear(params_t params); //only free the fields
 
 //The four basic operations; see paper
 
-void IBE_setup(params_t params, byte_string_t master,
+int IBE_setup(params_t params, byte_string_t master,
 	int k, int qk, char *system);
 //generate system parameters
+//returns 0 if p would be too large (see mont_maxbits)
 
 void IBE_extract(byte_string_t key,
 	byte_string_t master, const char *id, params_t params);
@@ -73,11 +84,19 @@ int IBE_serialize_params(byte_string_t bs, params_t params);
 //put system parameters into a byte_string
 int IBE_deserialize_params(params_t params, byte_string_t bs);
 //get system parameters from a byte_string
+//returns 0 if they cannot be used (e.g. p is too large)
 
 void IBE_extract_share(byte_string_t share,
 	byte_string_t master_share, const char *id, params_t params);
 //extract a private key share from an ID and master share
 
+void IBE_extract_share_batch(byte_string_t *share, byte_string_t mshare,
+	char **id, int n, int threads, params_t params);
+//share[i] = IBE_extract_share(mshare, id[i]) for 0 <= i < n,
+//using the given number of threads (1 or less means no new threads)
+//much faster per ID than IBE_extract_share, e.g. for reissuing
+//every user's key share
+
 int IBE_combine(byte_string_t key, byte_string_t *kshare, params_t params);
 //reconstruct a key from key shares
 //also reconstructs a certificate from certificate shares
@@ -87,6 +106,23 @@ int IBE_sharecount(params_t params);
 char* IBE_system(params_t params);
 char* IBE_version(params_t params);
 
+void IBE_set_id_cache_size(params_t params, int n);
+//remember the points of at most n IDs (0 turns the cache off)
+//hashing an ID to a point costs a scalar multiplication
+void IBE_set_gid_cache_size(params_t params, int n, size_t bytes);
+//when encrypting, remember the pairing values of at most n IDs,
+//using at most the given number of bytes (0 means no byte limit)
+//frequent recipients take more space but are cheaper to encrypt to
+void IBE_set_cert_cache_size(params_t params, int n);
+//when verifying, remember the certificate pairings of at most n signers
+void IBE_set_key_cache_size(params_t params, int n, size_t bytes);
+//when verifying BLS signatures, remember at most n public keys,
+//using at most the given number of bytes (0 means no byte limit)
+//keys that come up often are preprocessed, which takes space
+//(see IBE_cache_stats) but makes verifying cheaper
+void IBE_cache_stats(FILE *outfp, params_t params);
+//print hit, miss and eviction counts and memory use of the caches
+
 //for anonymous IBE:
 
 //we now use the Boneh-Franklin system as a Key Encapsulation Mechanism
@@ -150,11 +186,35 @@ typedef struct preprocessed_key_s preprocessed_key_t[1];
 void preprocessed_key_init(preprocessed_key_t pk, params_t params);
 void preprocessed_key_clear(preprocessed_key_t pk);
 
+void IBE_preprocess_key(preprocessed_key_t pk,
+	byte_string_t key, params_t params);
+//prepare a private key for repeated use
+//pk can then be used in place of the key by the *_preprocessed functions
+
 void IBE_get_shared_secret_preprocess(preprocessed_key_t pk,
 	byte_string_t key, params_t params);
+//same as IBE_preprocess_key
 void IBE_get_shared_secret_postprocess(byte_string_t s,
 	char *id, preprocessed_key_t pk, params_t params);
 
+void IBE_KEM_decrypt_preprocessed(byte_string_t secret,
+	byte_string_t U, preprocessed_key_t pk, params_t params);
+//IBE_KEM_decrypt with a preprocessed private key
+
+int IBE_reveal_key_preprocessed(byte_string_t K,
+	byte_string_t U, byte_string_t V, preprocessed_key_t pk, params_t params);
+//IBE_reveal_key with a preprocessed private key
+
+int IBE_serialize_preprocessed_key(byte_string_t bs,
+	preprocessed_key_t pk, params_t params);
+//put a preprocessed key into a byte_string
+//it reveals the private key, so store it as carefully as the key itself
+//(e.g. with FMT_crypt_save)
+int IBE_deserialize_preprocessed_key(preprocessed_key_t pk,
+	byte_string_t bs, params_t params);
+//get a preprocessed key from a byte_string
+//pk must already be initialized, returns 0 on error
+
 //Boneh-Lynn-Shacham signature routines
 //uses same system parameters as IBE
 
@@ -169,6 +229,23 @@ int BLS_verify(byte_string_t sig,
 	byte_string_t message, byte_string_t pubkey, params_t params);
 //verify a signature
 
+int BLS_verify_batch(int *valid, byte_string_t *sig,
+	byte_string_t *message, byte_string_t *pubkey, int n, params_t params);
+//verify n signatures (by the same or different keys) at once,
+//much faster than n calls to BLS_verify
+//returns 1 if they are all valid
+//if valid is not NULL, valid[i] is set to 1 if sig[i] is valid, 0 otherwise
+//(finding the bad signatures in a batch costs extra checks)
+
+void BLS_aggregate(byte_string_t agg, byte_string_t *sig, int n,
+	params_t params);
+//combine n signatures (on distinct messages) into one
+int BLS_aggregate_verify(byte_string_t agg,
+	byte_string_t *message, byte_string_t *pubkey, int n, params_t params);
+//verify an aggregate signature, where message[i] was signed
+//by the owner of pubkey[i]
+//fails if the messages are not distinct
+
 //We use BLS signatures to do identity-based signatures, by using certificates
 //Does signature aggregation to compress the certificate chain
 
@@ -13,6 +13,7 @@ See LICENSE for license
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
 #include "curve.h"
 #include "version.h"
 #include "benchmark.h"
@@ -20,6 +21,45 @@ See LICENSE for license
 #include "crypto.h"
 #include "mm.h"
 
+enum {
+    //default number of IDs whose points are remembered
+    idcache_default = 4096,
+    //default limits for the cache of pairing values gid
+    gidcache_default = 4096,
+    gidcache_default_bytes = 1 << 24,
+    //an ID encrypted to this many times before gets a fixed-base table
+    gidcache_hot = 2,
+    //default number of signers whose certificate pairing is remembered
+    certcache_default = 1024,
+    //default limits for the cache of preprocessed BLS public keys
+    keycache_default = 1024,
+    keycache_default_bytes = 1 << 24,
+    //a public key seen this many times before gets preprocessed
+    keycache_hot = 2,
+    //number of multiplications of a point after which
+    //it is worth building a fixed_base_t for it
+    fixed_base_uses = 8,
+    //IBE_extract_share_batch threads claim this many IDs at a time
+    extract_batch_chunk = 64,
+    //size of the random exponents used in batch verification
+    //a bad batch passes with probability about 2^-batch_bits
+    batch_bits = 64
+};
+
+struct gid_s {
+    int hot; //whether table holds fixed-base powers or only gid
+    mp_limb_t *table;
+};
+
+typedef struct gid_s *gid_ptr;
+
+struct pubkey_s {
+    int hot; //whether mc has been computed
+    miller_cache_t mc;
+};
+
+typedef struct pubkey_s *pubkey_ptr;
+
 void preprocessed_key_init(preprocessed_key_t pk, params_t params)
 {
     miller_cache_init(pk->mc, params->curve);
@@ -194,22 +234,114 @@ static void point_make_order_q(point_t P, params_t params)
 //P = ((p + 1)/q)P 
 //so it has order q
 {
-    point_mul(P, params->p1onq, P, params->curve);
+    point_mul_cofactor(P, P, params->curve);
+}
+
+static void idcache_free(void *value)
+{
+    point_clear((point_ptr) value);
+    free(value);
+}
+
+static void idcache_copy(void *dst, void *value)
+{
+    point_set((point_ptr) dst, (point_ptr) value);
+}
+
+static void gidcache_free(void *value)
+{
+    free(((gid_ptr) value)->table);
+    free(value);
+}
+
+static void certcache_free(void *value)
+{
+    fp2_clear((fp2_ptr) value);
+    free(value);
+}
+
+static void certcache_copy(void *dst, void *value)
+{
+    fp2_set((fp2_ptr) dst, (fp2_ptr) value);
+}
+
+static void keycache_free(void *value)
+{
+    pubkey_ptr k = (pubkey_ptr) value;
+
+    if (k->hot) miller_cache_clear(k->mc);
+    free(k);
+}
+
+static size_t pubkey_size(int hot, params_t params)
+//memory used by a cached public key
+{
+    size_t size = sizeof(struct pubkey_s);
+
+    if (hot) {
+	size += sizeof(mp_limb_t) * 3
+		* mpz_sizeinbase(params->q, 2) * params->curve->mont->n;
+    }
+    return size;
 }
 
-static void initpq(params_t params)
+static pubkey_ptr pubkey_new(point_ptr xP, params_t params, size_t *size)
+//cache entry for the public key xP, preprocessed if xP is not NULL
+{
+    pubkey_ptr k = (pubkey_ptr) malloc(sizeof(struct pubkey_s));
+
+    k->hot = xP != NULL;
+    if (k->hot) {
+	miller_cache_init(k->mc, params->curve);
+	tate_preprocess(k->mc, xP, params->curve);
+    }
+    *size = pubkey_size(k->hot, params);
+    return k;
+}
+
+static gid_ptr gid_new(fp2m_ptr x, int hot, params_t params, size_t *size)
+//cache entry for gid = x, with a fixed-base table if hot
+{
+    mont_ptr m = params->curve->mont;
+    int bits = mpz_sizeinbase(params->q, 2);
+    size_t limbs = hot ? fp2m_fixed_limbs(bits, m) : 2 * m->n;
+    gid_ptr g = (gid_ptr) malloc(sizeof(struct gid_s));
+
+    g->hot = hot;
+    g->table = (mp_limb_t *) malloc(sizeof(mp_limb_t) * limbs);
+    if (hot) {
+	fp2m_fixed_init(g->table, x, bits, m);
+    } else {
+	//same layout as the first entry of a table
+	mpn_copyi(g->table, x->a, m->n);
+	mpn_copyi(g->table + m->n, x->b, m->n);
+    }
+    *size = sizeof(struct gid_s) + sizeof(mp_limb_t) * limbs;
+    return g;
+}
+
+static int initpq(params_t params)
 //calculate system parameters that can be determined from p and q
 //also initialize the elliptic curve library so points can be used
+//returns 0 (having allocated nothing) if p is unusable
 {
+    //initialize the elliptic curve library
+    if (!curve_init(params->curve, params->p, params->q)) return 0;
+
     mpz_init(params->p1onq);
     mpz_add_ui(params->p1onq, params->p, 1);
     mpz_divexact(params->p1onq, params->p1onq, params->q);
 
-    //initialize the elliptic curve library
-    curve_init(params->curve, params->p, params->q);
-
     fp2_init(params->zeta);
     fp2_set_cbrt_unity(params->zeta, params->p);
+
+    lru_init(params->idcache, idcache_default, 0, idcache_free);
+    lru_init(params->gidcache, gidcache_default, gidcache_default_bytes,
+	    gidcache_free);
+    lru_init(params->certcache, certcache_default, 0, certcache_free);
+    lru_init(params->keycache, keycache_default, keycache_default_bytes,
+	    keycache_free);
+    return 1;
 }
 
 void hash_G(mpz_t h, byte_string_t bs, params_t params)
@@ -280,13 +412,53 @@ static void map_byte_string_to_point(point_t d,
     fp2_clear(y);
 }
 
+static void map_byte_string_to_point_array(point_ptr *d,
+	byte_string_t *bs, int n, params_t params)
+//d[i] = map_byte_string_to_point(bs[i]) for 0 <= i < n
+//the cofactor multiplications share their inversions
+{
+    int i;
+
+    for (i=0; i<n; i++) {
+	hash_G(d[i]->y->a, bs[i], params);
+	mpz_set_ui(d[i]->y->b, 0);
+	x_from_y(d[i]->x->a, d[i]->y->a, params->curve);
+	mpz_set_ui(d[i]->x->b, 0);
+	d[i]->infinity = 0;
+    }
+    point_mul_cofactor_array(d, d, n, params->curve);
+
+    //unlikely case: do it the slow way
+    for (i=0; i<n; i++) {
+	if (d[i]->infinity) map_byte_string_to_point(d[i], bs[i], params);
+    }
+}
+
+static void map_id_to_point(point_t d, byte_string_t id, params_t params)
+//converts an ID into a point of order q on E/F_p
+//same as map_byte_string_to_point, but the same IDs come up again
+//and again so recent results are kept in params->idcache
+{
+    point_ptr Q;
+
+    if (lru_lookup(params->idcache, id, idcache_copy, d)) return;
+
+    map_byte_string_to_point(d, id, params);
+
+    Q = (point_ptr) malloc(sizeof(struct point_s));
+    point_init(Q);
+    point_set(Q, d);
+    lru_insert(params->idcache, id, Q, sizeof(struct point_s)
+	    + sizeof(mp_limb_t) * (mpz_size(Q->x->a) + mpz_size(Q->y->a)));
+}
+
 static void map_to_point(point_t d, const char *id, params_t params)
 //converts id into a point of order q on E/F_p
 {
     byte_string_t bsid;
 
     byte_string_set(bsid, id);
-    map_byte_string_to_point(d, bsid, params);
+    map_id_to_point(d, bsid, params);
     byte_string_clear(bsid);
 }
 
@@ -300,9 +472,17 @@ void IBE_clear(void)
 /* Free memory used by library
  */
 {
+    fp2_scratch_clear();
     crypto_clear();
 }
 
+void IBE_thread_clear(void)
+/* Free memory the library holds for the calling thread
+ */
+{
+    fp2_scratch_clear();
+}
+
 void params_robust_clear(params_t params)
 {
     int i;
@@ -323,7 +503,13 @@ void params_clear(params_t params)
     mpz_clear(params->p1onq);
     fp2_clear(params->zeta);
 
+    fixed_base_clear(params->P_fb);
+    miller_cache_clear(params->P_mc);
     miller_cache_clear(params->Ppub_mc);
+    lru_clear(params->idcache);
+    lru_clear(params->gidcache);
+    lru_clear(params->certcache);
+    lru_clear(params->keycache);
 
     if (params->sharen) params_robust_clear(params);
 
@@ -337,11 +523,12 @@ void params_clear(params_t params)
     free(params->id);
 }
 
-void IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
+int IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
 /* generate system parameters
- * k = number of bits in p (should be at least 512)
+ * k = number of bits in p (should be at least 512, at most mont_maxbits)
  * qk = number of bits in q (size of subgroup, 160 is typical)
  * id = system ID
+ * returns 0 if k is out of range
  */
 {
     mpz_t p, q, r;
@@ -353,6 +540,12 @@ void IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
     int kqk = k - qk - 4; //lose 4 bits since 12 is a 4-bit no.
     unsigned int seed;
 
+    //p < 12 * 2^qk * 2^kqk <= 2^k, so this is all curve_init needs
+    if (k > mont_maxbits) {
+	fprintf(stderr, "IBE_setup: p may have at most %d bits\n", mont_maxbits);
+	return 0;
+    }
+
     mpz_init(p); mpz_init(q); mpz_init(r); mpz_init(x);
 
     //find random k-bit prime p such that
@@ -414,7 +607,12 @@ void IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
     mpz_set(params->p, p);
     mpz_set(params->q, q);
 
-    initpq(params);
+    if (!initpq(params)) {
+	mpz_clear(params->p); mpz_clear(params->q);
+	byte_string_clear(master);
+	mpz_clear(p); mpz_clear(q); mpz_clear(r); mpz_clear(x);
+	return 0;
+    }
 
     //pick random point P of order q from E/F_p
     point_init(params->P);
@@ -425,11 +623,13 @@ void IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
 	point_make_order_q(P, params);
     } while (P->infinity);
 
-    point_init(params->Ppub);
-    point_mul(params->Ppub, x, P, params->curve);
+    fixed_base_init(params->P_fb, P, fixed_base_width, params->curve);
 
-    point_mul_preprocess(P, params->curve);
+    point_init(params->Ppub);
+    point_mul_postprocess(params->Ppub, x, params->P_fb, params->curve);
 
+    miller_cache_init(params->P_mc, params->curve);
+    tate_preprocess(params->P_mc, P, params->curve);
     miller_cache_init(params->Ppub_mc, params->curve);
     tate_preprocess(params->Ppub_mc, params->Ppub, params->curve);
 
@@ -444,6 +644,7 @@ void IBE_setup(params_t params, byte_string_t master, int k, int qk, char *id)
     strcpy(params->version, IBE_VERSION);
 
     mpz_clear(p); mpz_clear(q); mpz_clear(r); mpz_clear(x);
+    return 1;
 }
 
 void IBE_extract_byte_string(byte_string_t bs, byte_string_t master,
@@ -456,7 +657,7 @@ void IBE_extract_byte_string(byte_string_t bs, byte_string_t master,
     mpz_init(x);
     point_init(key);
 
-    map_byte_string_to_point(key, id, params);
+    map_id_to_point(key, id, params);
 
     mympz_set_byte_string(x, master);
     point_mul(key, x, key, params->curve);
@@ -499,7 +700,7 @@ void IBE_extract_share_byte_string(byte_string_t share, byte_string_t mshare,
     byte_string_clear(bs1);
     byte_string_clear(bs2);
 
-    map_byte_string_to_point(d, id, params);
+    map_id_to_point(d, id, params);
 
     point_mul(yd, y, d, params->curve);
 
@@ -525,21 +726,148 @@ void IBE_extract_share(byte_string_t share,
     byte_string_clear(bsid);
 }
 
+struct extract_batch_s {
+    pthread_mutex_t lock;
+    int next; //first ID not yet claimed by a thread
+    int n;
+    byte_string_t *share;
+    char **id;
+    int index; //of the master share
+    mpz_t y; //the master share
+    struct params_s *params;
+};
+
+static void extract_share_chunk(struct extract_batch_s *b, int start, int n)
+//shares for IDs start, ..., start + n - 1
+{
+    int i;
+    byte_string_t bsid[extract_batch_chunk];
+    point_t d[extract_batch_chunk];
+    point_ptr dp[extract_batch_chunk];
+    byte_string_t bs1, bs2;
+
+    for (i=0; i<n; i++) {
+	byte_string_set(bsid[i], b->id[start + i]);
+	point_init(d[i]);
+	dp[i] = d[i];
+    }
+
+    //each ID is seen once, so this bypasses params->idcache
+    //rather than flush it
+    map_byte_string_to_point_array(dp, bsid, n, b->params);
+    point_mul_array(dp, b->y, dp, n, b->params->curve);
+
+    for (i=0; i<n; i++) {
+	byte_string_set_int(bs1, b->index);
+	byte_string_set_point(bs2, d[i]);
+	byte_string_join(b->share[start + i], bs1, bs2);
+	byte_string_clear(bs1);
+	byte_string_clear(bs2);
+	byte_string_clear(bsid[i]);
+	point_clear(d[i]);
+    }
+}
+
+static void extract_share_work(struct extract_batch_s *b)
+//claim chunks of IDs until there are none left
+{
+    int start, n;
+
+    for (;;) {
+	pthread_mutex_lock(&b->lock);
+	start = b->next;
+	n = b->n - start;
+	if (n > extract_batch_chunk) n = extract_batch_chunk;
+	b->next += n;
+	pthread_mutex_unlock(&b->lock);
+	if (n <= 0) break;
+	extract_share_chunk(b, start, n);
+    }
+}
+
+static void *extract_share_thread(void *arg)
+{
+    extract_share_work((struct extract_batch_s *) arg);
+    IBE_thread_clear();
+    return NULL;
+}
+
+void IBE_extract_share_batch(byte_string_t *share, byte_string_t mshare,
+	char **id, int n, int threads, params_t params)
+//IBE_extract_share for many IDs: the master share is parsed once,
+//and the IDs are handled in chunks, each mapped to points and then
+//multiplied by the share with point_mul_array
+{
+    struct extract_batch_s b;
+    pthread_t *tid;
+    byte_string_t bs1, bs2;
+    int i, started;
+
+    if (n <= 0) return;
+
+    byte_string_split(bs1, bs2, mshare);
+    b.index = int_from_byte_string(bs1);
+    mpz_init(b.y);
+    mympz_set_byte_string(b.y, bs2);
+    byte_string_clear(bs1);
+    byte_string_clear(bs2);
+
+    pthread_mutex_init(&b.lock, NULL);
+    b.next = 0;
+    b.n = n;
+    b.share = share;
+    b.id = id;
+    b.params = params;
+
+    //no point having threads with nothing to do
+    i = (n + extract_batch_chunk - 1) / extract_batch_chunk;
+    if (threads > i) threads = i;
+
+    if (threads <= 1) {
+	for (i=0; i<n; i+=extract_batch_chunk) {
+	    extract_share_chunk(&b, i, n - i < extract_batch_chunk ?
+		    n - i : extract_batch_chunk);
+	}
+    } else {
+	tid = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	for (started=0; started<threads; started++) {
+	    if (pthread_create(&tid[started], NULL, extract_share_thread, &b)) {
+		break;
+	    }
+	}
+	//if a thread could not be started, this one works alongside
+	//the others (or alone) until every chunk has been claimed
+	if (started < threads) extract_share_work(&b);
+	for (i=0; i<started; i++) {
+	    pthread_join(tid[i], NULL);
+	}
+	free(tid);
+    }
+
+    pthread_mutex_destroy(&b.lock);
+    mpz_clear(b.y);
+}
+
 int IBE_combine(byte_string_t key, byte_string_t *kshare, params_t params)
 //reconstruct a key from key shares, or a certificate from certificate shares
+//the key is sum z_i y_i P where the z_i are Lagrange coefficients:
+//their denominators are inverted together, and the sum is
+//a single multi-scalar multiplication
 {
     int i, j;
+    int t = params->sharet;
     int indexi, indexj;
-    point_t yP;
-    mpz_t num, denom;
+    point_t *yP;
+    point_ptr *yPp;
+    mpz_t *num, *denom;
     mpz_t z;
     point_t d;
     byte_string_t bs1, bs2;
     int *index;
 
-    index = (int *) alloca(params->sharet * sizeof(int));
+    index = (int *) alloca(t * sizeof(int));
 
-    for (i=0; i<params->sharet; i++) {
+    for (i=0; i<t; i++) {
 	byte_string_split(bs1, bs2, kshare[i]);
 	byte_string_clear(bs2);
 	index[i] = int_from_byte_string(bs1);
@@ -551,47 +879,60 @@ int IBE_combine(byte_string_t key, byte_string_t *kshare, params_t params)
 	}
     }
 
-    point_init(yP);
+    yP = (point_t *) malloc(t * sizeof(point_t));
+    yPp = (point_ptr *) malloc(t * sizeof(point_ptr));
+    num = (mpz_t *) malloc(t * sizeof(mpz_t));
+    denom = (mpz_t *) malloc(t * sizeof(mpz_t));
     mpz_init(z);
-    mpz_init(num); mpz_init(denom);
     point_init(d);
-    point_set_O(d);
 
-    for (i=0; i<params->sharet; i++) {
+    for (i=0; i<t; i++) {
+	point_init(yP[i]);
+	yPp[i] = yP[i];
 	byte_string_split(bs1, bs2, kshare[i]);
 	indexi = index[i];
 	byte_string_clear(bs1);
-	point_set_byte_string(yP, bs2);
+	point_set_byte_string(yP[i], bs2);
 	byte_string_clear(bs2);
-	mpz_set_ui(num, 1);
-	mpz_set_ui(denom, 1);
-	for (j=0; j<params->sharet; j++) {
+	mpz_init_set_ui(num[i], 1);
+	mpz_init_set_ui(denom[i], 1);
+	for (j=0; j<t; j++) {
 	    if (j != i) {
 		indexj = index[j];
-		mpz_mul(num, num, params->robustx[indexj]);
-		mpz_mod(num, num, params->q);
+		mpz_mul(num[i], num[i], params->robustx[indexj]);
+		mpz_mod(num[i], num[i], params->q);
 		mpz_sub(z, params->robustx[indexj], params->robustx[indexi]);
-		mpz_mul(denom, denom, z);
-		mpz_mod(denom, denom, params->q);
+		mpz_mul(denom[i], denom[i], z);
+		mpz_mod(denom[i], denom[i], params->q);
 	    }
 	}
-	mpz_invert(denom, denom, params->q);
-	mpz_mul(z, num, denom);
-	mpz_mod(z, z, params->q);
-	point_mul(yP, z, yP, params->curve);
-	point_add(d, d, yP, params->curve);
     }
+
+    fp_batch_inv(denom, denom, t, params->q);
+    for (i=0; i<t; i++) {
+	mpz_mul(num[i], num[i], denom[i]);
+	mpz_mod(num[i], num[i], params->q);
+    }
+
+    point_multi_mul(d, num, yPp, t, params->curve);
     byte_string_set_point(key, d);
 
-    point_clear(yP);
+    for (i=0; i<t; i++) {
+	point_clear(yP[i]);
+	mpz_clear(num[i]);
+	mpz_clear(denom[i]);
+    }
+    free(yP);
+    free(yPp);
+    free(num);
+    free(denom);
     mpz_clear(z);
-    mpz_clear(num); mpz_clear(denom);
     point_clear(d);
 
     return 1;
 }
 
-void IBE_get_shared_secret_preprocess(preprocessed_key_t pk,
+void IBE_preprocess_key(preprocessed_key_t pk,
 	byte_string_t key, params_t params)
 {
     point_t Q;
@@ -604,6 +945,138 @@ void IBE_get_shared_secret_preprocess(preprocessed_key_t pk,
     point_clear(Q);
 }
 
+void IBE_get_shared_secret_preprocess(preprocessed_key_t pk,
+	byte_string_t key, params_t params)
+{
+    IBE_preprocess_key(pk, key, params);
+}
+
+int IBE_serialize_preprocessed_key(byte_string_t bs,
+	preprocessed_key_t pk, params_t params)
+//put a preprocessed key into a byte_string
+//entries are stored out of Montgomery form so they do not depend
+//on the limb size of the machine, and the tangents as numa x + y + numc
+//so they do not depend on how tate_preprocess scales them
+{
+    int i, j;
+    int steps = abs(params->curve->solinasa);
+    miller_cache_ptr mc = pk->mc;
+    mont_ptr m = params->curve->mont;
+    byte_string_t *bsa;
+    mpz_t z;
+    mp_limb_t *fixed[6];
+    mp_ptr numa;
+
+    fixed[0] = mc->denomsb;
+    fixed[1] = mc->denoms1;
+    fixed[2] = mc->numl1a;
+    fixed[3] = mc->numl1c;
+    fixed[4] = mc->denoml1c;
+    fixed[5] = mc->numl2c;
+
+    bsa = (byte_string_t *) malloc(sizeof(byte_string_t) * (3 * steps + 7));
+    mpz_init(z);
+
+    //numa = 1/numb, numc = numa times the cached numc
+    numa = (mp_ptr) malloc(sizeof(mp_limb_t) * steps * m->n);
+    mont_batch_inv(numa, mc->numb, steps, m);
+
+    i = 0;
+    byte_string_set_int(bsa[i++], steps);
+    for (j=0; j<steps; j++) {
+	mont_get_mpz(z, numa + j * m->n, m);
+	byte_string_set_mpz(bsa[i++], z);
+	mont_mul(numa + j * m->n, numa + j * m->n, mc->numc + j * m->n, m);
+	mont_get_mpz(z, numa + j * m->n, m);
+	byte_string_set_mpz(bsa[i++], z);
+	mont_get_mpz(z, mc->denomc + j * m->n, m);
+	byte_string_set_mpz(bsa[i++], z);
+    }
+    for (j=0; j<6; j++) {
+	mont_get_mpz(z, fixed[j], m);
+	byte_string_set_mpz(bsa[i++], z);
+    }
+
+    byte_string_encode_array(bs, bsa, i);
+
+    for (j=0; j<i; j++) {
+	byte_string_clear(bsa[j]);
+    }
+    free(bsa);
+    free(numa);
+    mpz_clear(z);
+
+    return 1;
+}
+
+int IBE_deserialize_preprocessed_key(preprocessed_key_t pk,
+	byte_string_t bs, params_t params)
+//get a preprocessed key from a byte_string
+//pk must have been initialized with preprocessed_key_init()
+//returns 0 if bs does not hold a preprocessed key for these params
+{
+    int i, j, n;
+    int result = 0;
+    int steps = abs(params->curve->solinasa);
+    miller_cache_ptr mc = pk->mc;
+    mont_ptr m = params->curve->mont;
+    byte_string_t *bsa;
+    mpz_t z;
+    mp_limb_t *fixed[6];
+
+    fixed[0] = mc->denomsb;
+    fixed[1] = mc->denoms1;
+    fixed[2] = mc->numl1a;
+    fixed[3] = mc->numl1c;
+    fixed[4] = mc->denoml1c;
+    fixed[5] = mc->numl2c;
+
+    byte_string_decode_array(&bsa, &n, bs);
+    mpz_init(z);
+
+    if (n != 3 * steps + 7) goto done;
+    if (int_from_byte_string(bsa[0]) != steps) goto done;
+    for (i=1; i<n; i++) {
+	mympz_set_byte_string(z, bsa[i]);
+	if (mpz_cmp(z, params->p) >= 0) goto done;
+    }
+    for (j=0; j<steps; j++) {
+	//numa, which must be invertible
+	mympz_set_byte_string(z, bsa[1 + 3 * j]);
+	if (!mpz_sgn(z)) goto done;
+    }
+
+    i = 1;
+    for (j=0; j<steps; j++) {
+	mympz_set_byte_string(z, bsa[i++]);
+	mont_set_mpz(mc->numb + j * m->n, z, m);
+	mympz_set_byte_string(z, bsa[i++]);
+	mont_set_mpz(mc->numc + j * m->n, z, m);
+	mympz_set_byte_string(z, bsa[i++]);
+	mont_set_mpz(mc->denomc + j * m->n, z, m);
+    }
+    for (j=0; j<6; j++) {
+	mympz_set_byte_string(z, bsa[i++]);
+	mont_set_mpz(fixed[j], z, m);
+    }
+    //back to the scaling of tate_preprocess (see above)
+    mont_batch_inv(mc->numb, mc->numb, steps, m);
+    for (j=0; j<steps; j++) {
+	mont_mul(mc->numc + j * m->n, mc->numc + j * m->n,
+		mc->numb + j * m->n, m);
+    }
+    result = 1;
+
+done:
+    for(i=0; i<n; i++) {
+	byte_string_clear(bsa[i]);
+    }
+    free(bsa);
+    mpz_clear(z);
+
+    return result;
+}
+
 void IBE_get_shared_secret_postprocess(byte_string_t s,
 	char *id, preprocessed_key_t pk, params_t params)
 {
@@ -623,14 +1096,93 @@ void IBE_get_shared_secret_postprocess(byte_string_t s,
     point_clear(Qid);
 }
 
+static int gid_power_cached(fp2_ptr gidr, const char *id, mpz_t r,
+	params_t params)
+//gidr = gid^r where gid = e(Q_id, Phi(P_pub)), if gid is in
+//params->gidcache, and returns 1, otherwise returns 0
+//IDs that come up often get a fixed-base table, after which
+//encrypting to them needs neither a Miller loop nor a Tate power
+{
+    byte_string_t bsid;
+    lru_entry_ptr e;
+    unsigned long hits;
+    gid_ptr g, g2 = NULL;
+    size_t size;
+    mont_ptr m = params->curve->mont;
+    int bits = mpz_sizeinbase(params->q, 2);
+    fp2m_t x, y;
+
+    byte_string_set(bsid, id);
+    e = lru_acquire(params->gidcache, bsid, &hits);
+    if (!e) {
+	byte_string_clear(bsid);
+	return 0;
+    }
+    bm_put(bm_get_time(), "miller0");
+    bm_put(bm_get_time(), "miller1");
+    g = (gid_ptr) lru_entry_value(e);
+    if (!g->hot && hits >= gidcache_hot) {
+	mpn_copyi(x->a, g->table, m->n);
+	mpn_copyi(x->b, g->table + m->n, m->n);
+	g2 = gid_new(x, 1, params, &size);
+    }
+    bm_put(bm_get_time(), "gidr0");
+    if (g2) {
+	fp2m_fixed_pow_unitary(y, g2->table, bits, r, m);
+	//g2 belongs to the cache after this
+	lru_insert(params->gidcache, bsid, g2, size);
+    } else if (g->hot) {
+	fp2m_fixed_pow_unitary(y, g->table, bits, r, m);
+    } else {
+	mpn_copyi(x->a, g->table, m->n);
+	mpn_copyi(x->b, g->table + m->n, m->n);
+	fp2m_pow_unitary(y, x, r, m);
+    }
+    lru_release(params->gidcache, e);
+    fp2m_get_fp2(gidr, y, m);
+    bm_put(bm_get_time(), "gidr1");
+
+    byte_string_clear(bsid);
+    return 1;
+}
+
+static void gid_power_insert(fp2_ptr gidr, const char *id, fp2_ptr gid,
+	mpz_t r, params_t params)
+//gidr = gid^r, where gid = e(Q_id, Phi(P_pub)) has just been computed
+//and goes into params->gidcache
+{
+    byte_string_t bsid;
+    gid_ptr g;
+    size_t size;
+    mont_ptr m = params->curve->mont;
+    fp2m_t x, y;
+
+    byte_string_set(bsid, id);
+    bm_put(bm_get_time(), "gidr0");
+    fp2m_set_fp2(x, gid, m);
+    g = gid_new(x, 0, params, &size);
+    lru_insert(params->gidcache, bsid, g, size);
+    fp2m_pow_unitary(y, x, r, m);
+    fp2m_get_fp2(gidr, y, m);
+    bm_put(bm_get_time(), "gidr1");
+
+    byte_string_clear(bsid);
+}
+
 void IBE_KEM_encrypt_array(byte_string_t *s, byte_string_t U,
 	char **idarray, int count, params_t params)
+//the IDs missing from params->gidcache are gathered up to
+//miller_batch_chunk at a time, and their pairings computed together
+//by tate_postprocess_batch
 {
-    int i;
+    int i, j, k;
     mpz_t r;
     fp2_t gidr;
-    point_t Qid;
     point_t rP;
+    point_t Q[miller_batch_chunk];
+    point_ptr Qp[miller_batch_chunk];
+    fp2_t gid[miller_batch_chunk];
+    int index[miller_batch_chunk];
 
     if (count <= 0) return;
 
@@ -642,7 +1194,7 @@ void IBE_KEM_encrypt_array(byte_string_t *s, byte_string_t U,
     //U = rP
     point_init(rP);
     //point_mul(rP, r, params->P);
-    point_mul_postprocess(rP, r, params->curve);
+    point_mul_postprocess(rP, r, params->P_fb, params->curve);
     bm_put(bm_get_time(), "rP1");
     fp2_init(gidr);
 
@@ -650,28 +1202,37 @@ void IBE_KEM_encrypt_array(byte_string_t *s, byte_string_t U,
 
     point_clear(rP);
 
-    point_init(Qid);
+    for (k=0; k<miller_batch_chunk; k++) {
+	point_init(Q[k]);
+	Qp[k] = Q[k];
+	fp2_init(gid[k]);
+    }
 
+    k = 0;
     for (i=0; i<count; i++) {
-	const char *id = idarray[i];
-
-	//XXX:set up a cache to avoid these expensive ops
-	map_to_point(Qid, id, params);
-	point_Phi(Qid, Qid, params);
-	
 	//calculate gidr = e(Q_id, Phi(P_pub))^r
-
-	//tate_pairing(gidr, Qid, PhiPpub);
-	tate_postprocess(gidr, params->Ppub_mc, Qid, params->curve);
-
-	bm_put(bm_get_time(), "gidr0");
-	fp2_pow(gidr, gidr, r, params->p);
-	bm_put(bm_get_time(), "gidr1");
-
-	hash_H(s[i], gidr, params);
+	if (gid_power_cached(gidr, idarray[i], r, params)) {
+	    hash_H(s[i], gidr, params);
+	} else {
+	    map_to_point(Q[k], idarray[i], params);
+	    point_Phi(Q[k], Q[k], params);
+	    index[k++] = i;
+	}
+	if (k == miller_batch_chunk || (k && i == count - 1)) {
+	    //tate_pairing(gid, Qid, PhiPpub);
+	    tate_postprocess_batch(gid, params->Ppub_mc, Qp, k, params->curve);
+	    for (j=0; j<k; j++) {
+		gid_power_insert(gidr, idarray[index[j]], gid[j], r, params);
+		hash_H(s[index[j]], gidr, params);
+	    }
+	    k = 0;
+	}
     }
 
-    point_clear(Qid);
+    for (k=0; k<miller_batch_chunk; k++) {
+	point_clear(Q[k]);
+	fp2_clear(gid[k]);
+    }
     mpz_clear(r);
     fp2_clear(gidr);
 }
@@ -708,6 +1269,25 @@ void IBE_KEM_decrypt(byte_string_t s,
     point_clear(rP);
 }
 
+void IBE_KEM_decrypt_preprocessed(byte_string_t s,
+	byte_string_t U, preprocessed_key_t pk, params_t params)
+{
+    point_t rP;
+    fp2_t res;
+
+    fp2_init(res);
+    point_init(rP);
+
+    point_set_byte_string(rP, U);
+
+    point_Phi(rP, rP, params);
+    tate_postprocess(res, pk->mc, rP, params->curve);
+    hash_H(s, res, params);
+
+    fp2_clear(res);
+    point_clear(rP);
+}
+
 void IBE_get_shared_secret(byte_string_t s,
 	char *id, byte_string_t key, params_t params)
 {
@@ -742,6 +1322,49 @@ char* IBE_system(params_t params)
     return params->id;
 }
 
+void IBE_set_id_cache_size(params_t params, int n)
+{
+    lru_resize(params->idcache, n, 0);
+}
+
+void IBE_set_gid_cache_size(params_t params, int n, size_t bytes)
+{
+    lru_resize(params->gidcache, n, bytes);
+}
+
+void IBE_set_cert_cache_size(params_t params, int n)
+{
+    lru_resize(params->certcache, n, 0);
+}
+
+void IBE_set_key_cache_size(params_t params, int n, size_t bytes)
+{
+    lru_resize(params->keycache, n, bytes);
+}
+
+void IBE_cache_stats(FILE *outfp, params_t params)
+{
+    unsigned long hits, misses, evictions;
+    int count;
+
+    size_t bytes;
+
+    lru_stats(params->idcache, &hits, &misses, &evictions, &count, NULL);
+    fprintf(outfp, "ID cache: %d entries, %lu hits, %lu misses, %lu evictions\n",
+	    count, hits, misses, evictions);
+    lru_stats(params->gidcache, &hits, &misses, &evictions, &count, &bytes);
+    fprintf(outfp, "gid cache: %d entries (%lu bytes), %lu hits, %lu misses, %lu evictions\n",
+	    count, (unsigned long) bytes, hits, misses, evictions);
+    lru_stats(params->certcache, &hits, &misses, &evictions, &count, NULL);
+    fprintf(outfp, "certificate cache: %d entries, %lu hits, %lu misses, %lu evictions\n",
+	    count, hits, misses, evictions);
+    lru_stats(params->keycache, &hits, &misses, &evictions, &count, &bytes);
+    fprintf(outfp, "public key cache: %d entries (%lu bytes, %lu per preprocessed key), %lu hits, %lu misses (%.1f%% hit rate), %lu evictions\n",
+	    count, (unsigned long) bytes,
+	    (unsigned long) pubkey_size(1, params), hits, misses,
+	    hits + misses ? 100.0 * hits / (hits + misses) : 0.0, evictions);
+}
+
 int IBE_threshold(params_t params)
 {
     return params->sharet;
@@ -810,9 +1433,21 @@ void IBE_split_master(byte_string_t *mshare,
 	byte_string_clear(bs2);
     }
 
-    for (i=0; i<n; i++) {
-	point_init(params->robustP[i]);
-	point_mul(params->robustP[i], y[i], params->Ppub, params->curve);
+    //with enough shares a table for Ppub pays for itself
+    if (n >= fixed_base_uses) {
+	fixed_base_t fb;
+
+	fixed_base_init(fb, params->Ppub, fixed_base_width, params->curve);
+	for (i=0; i<n; i++) {
+	    point_init(params->robustP[i]);
+	    point_mul_postprocess(params->robustP[i], y[i], fb, params->curve);
+	}
+	fixed_base_clear(fb);
+    } else {
+	for (i=0; i<n; i++) {
+	    point_init(params->robustP[i]);
+	    point_mul(params->robustP[i], y[i], params->Ppub, params->curve);
+	}
     }
 
     for (i=0; i<t; i++) {
@@ -944,8 +1579,18 @@ int IBE_deserialize_params(params_t params, byte_string_t bs)
     mympz_set_byte_string(params->p, bsa[i++]);
     mympz_set_byte_string(params->q, bsa[i++]);
 
-    initpq(params);
-    
+    if (!initpq(params)) {
+	mpz_clear(params->p);
+	mpz_clear(params->q);
+	free(params->version);
+	free(params->id);
+	for(i=0; i<n; i++) {
+	    byte_string_clear(bsa[i]);
+	}
+	free(bsa);
+	return 0;
+    }
+
     point_init(params->P);
     point_init(params->Ppub);
 
@@ -968,7 +1613,9 @@ int IBE_deserialize_params(params_t params, byte_string_t bs)
 	point_set_byte_string(params->robustP[j], bsa[i++]);
     }
 
-    point_mul_preprocess(params->P, params->curve);
+    fixed_base_init(params->P_fb, params->P, fixed_base_width, params->curve);
+    miller_cache_init(params->P_mc, params->curve);
+    tate_preprocess(params->P_mc, params->P, params->curve);
     miller_cache_init(params->Ppub_mc, params->curve);
     tate_preprocess(params->Ppub_mc, params->Ppub, params->curve);
 
@@ -1012,7 +1659,7 @@ void BLS_keygen(byte_string_t private, byte_string_t public, params_t params)
 
     //public = x params->P
     point_init(xP);
-    point_mul(xP, x, params->P, params->curve);
+    point_mul_postprocess(xP, x, params->P_fb, params->curve);
     byte_string_set_point(public, xP);
 
     mpz_clear(x);
@@ -1043,35 +1690,79 @@ void BLS_sign(byte_string_t sig,
     point_clear(xP);
 }
 
-int is_DDH_tuple(point_t P, point_t aP, point_t bP, point_t cP, params_t params)
+static int DDH_check(point_t P, point_t aP, miller_cache_ptr amc,
+	point_t bP, point_t cP, params_t params)
+//checks e(P, Phi(cP)) e(-aP, Phi(bP)) = 1
+//rather than comparing two pairings
+//when P is the system's P, its Miller loop is already done,
+//as is that of aP if amc (from tate_preprocess(amc, aP)) is not NULL
 {
     int result;
-    fp2_t a, b;
-    point_t PhicP, PhibP;
+    fp2_t f, one;
+    point_t minusaP, PhicP, PhibP;
+    point_ptr L[2], M[2], R[2];
+    miller_cache_ptr mc[2];
+    int m = 0, n = 0;
 
-    fp2_init(a); fp2_init(b);
-    point_init(PhibP); point_init(PhicP);
+    fp2_init(f); fp2_init(one);
+    point_init(minusaP); point_init(PhibP); point_init(PhicP);
 
     point_Phi(PhicP, cP, params);
     point_Phi(PhibP, bP, params);
-    tate_pairing(a, P, PhicP, params->curve);
-    tate_pairing(b, aP, PhibP, params->curve);
-    result = fp2_equal(a, b);
 
+    if (point_equal(P, params->P)) {
+	mc[m] = params->P_mc;
+	R[m] = PhicP;
+	m++;
+    } else {
+	L[n] = P;
+	M[n] = PhicP;
+	n++;
+    }
+    if (amc) {
+	//e(-aP, Phi(bP)) = e(aP, -Phi(bP))
+	fp2_neg(PhibP->y, PhibP->y, params->p);
+	mc[m] = amc;
+	R[m] = PhibP;
+	m++;
+    } else {
+	point_set(minusaP, aP);
+	fp2_neg(minusaP->y, minusaP->y, params->p);
+	L[n] = minusaP;
+	M[n] = PhibP;
+	n++;
+    }
+    tate_product_postprocess(f, mc, R, m, L, M, n, params->curve);
+    fp2_set_1(one);
+    result = fp2_equal(f, one);
+
+    point_clear(minusaP);
     point_clear(PhibP);
     point_clear(PhicP);
 
-    fp2_clear(a); fp2_clear(b);
+    fp2_clear(f); fp2_clear(one);
     return result;
 }
 
+int is_DDH_tuple(point_t P, point_t aP, point_t bP, point_t cP, params_t params)
+{
+    return DDH_check(P, aP, NULL, bP, cP, params);
+}
+
 int BLS_verify(byte_string_t sig,
 	byte_string_t message, byte_string_t pubkey, params_t params)
+//public keys that come up often are preprocessed and kept in
+//params->keycache, after which verifying needs no full Miller loop
 {
     int result;
 
     point_t P, xP;
     point_t Q, xQ;
+    lru_entry_ptr e;
+    unsigned long hits;
+    pubkey_ptr k, k2 = NULL;
+    miller_cache_ptr mc = NULL;
+    size_t size;
 
     point_init(P);
     point_init(xP);
@@ -1087,8 +1778,28 @@ int BLS_verify(byte_string_t sig,
     point_set_byte_string(xP, pubkey);
     point_set(P, params->P);
 
+    e = lru_acquire(params->keycache, pubkey, &hits);
+    if (e) {
+	k = (pubkey_ptr) lru_entry_value(e);
+	if (k->hot) {
+	    mc = k->mc;
+	} else if (hits >= keycache_hot && !xP->infinity) {
+	    k2 = pubkey_new(xP, params, &size);
+	    mc = k2->mc;
+	}
+    }
+
     //verify P, xP, Q, xQ is DDH
-    result = is_DDH_tuple(P, xP, Q, xQ, params);
+    result = DDH_check(P, xP, mc, Q, xQ, params);
+
+    if (!e) {
+	k = pubkey_new(NULL, params, &size);
+	lru_insert(params->keycache, pubkey, k, size);
+    } else {
+	//k2 belongs to the cache after this
+	if (k2) lru_insert(params->keycache, pubkey, k2, size);
+	lru_release(params->keycache, e);
+    }
 
     point_clear(P);
     point_clear(xP);
@@ -1098,6 +1809,241 @@ int BLS_verify(byte_string_t sig,
     return result;
 }
 
+static int BLS_check_batch(point_ptr agg, int *index, int n, point_t *sig,
+	point_t *H, point_t *pub, byte_string_t *pubkey, params_t params)
+//check the signatures sig[index[0]], ..., sig[index[n-1]] together:
+//with random r_i (r_0 = 1), the product
+//e(P, Phi(sum r_i sig_i)) prod e(-pub, Phi(sum of r_i H_i over its messages))
+//is 1 if they are all valid, so only one Miller loop per distinct
+//public key (plus one) and a single final exponentiation are needed
+//if sig is NULL, agg is an aggregate signature and every r_i = 1
+{
+    int i, j, k;
+    int count = 1;
+    int result;
+    mpz_t r;
+    point_t R;
+    point_t *S, *minus;
+    int *key;
+    point_ptr *L;
+    miller_cache_ptr mc[1];
+    fp2_t f, one;
+
+    mpz_init(r);
+    point_init(R);
+    fp2_init(f); fp2_init(one);
+
+    //S[0] accumulates the signatures, S[1...] the hashes for each key
+    S = (point_t *) malloc(sizeof(point_t) * (n + 1));
+    minus = (point_t *) malloc(sizeof(point_t) * (n + 1));
+    key = (int *) malloc(sizeof(int) * (n + 1));
+    L = (point_ptr *) malloc(sizeof(point_ptr) * 2 * (n + 1));
+    point_init(S[0]);
+    if (!sig) point_set(S[0], agg);
+
+    for (i=0; i<n; i++) {
+	j = index[i];
+	if (!sig) {
+	    point_set(R, H[j]);
+	} else if (i) {
+	    do {
+		mympz_randomb(r, batch_bits);
+	    } while (!mpz_sgn(r));
+	    point_mul(R, r, sig[j], params->curve);
+	    point_add(S[0], S[0], R, params->curve);
+	    point_mul(R, r, H[j], params->curve);
+	} else {
+	    point_set(S[0], sig[j]);
+	    point_set(R, H[j]);
+	}
+
+	for (k=1; k<count; k++) {
+	    if (!byte_string_cmp(pubkey[key[k]], pubkey[j])) break;
+	}
+	if (k == count) {
+	    key[count] = j;
+	    point_init(S[count]);
+	    point_set(S[count], R);
+	    count++;
+	} else {
+	    point_add(S[k], S[k], R, params->curve);
+	}
+    }
+
+    //the pairing with P is done with P_mc
+    mc[0] = params->P_mc;
+    for (k=1; k<count; k++) {
+	point_init(minus[k]);
+	point_set(minus[k], pub[key[k]]);
+	fp2_neg(minus[k]->y, minus[k]->y, params->p);
+	L[k] = minus[k];
+    }
+    for (k=0; k<count; k++) {
+	point_Phi(S[k], S[k], params);
+	L[count + k] = S[k];
+    }
+    tate_product_postprocess(f, mc, L + count, 1,
+	    L + 1, L + count + 1, count - 1, params->curve);
+    fp2_set_1(one);
+    result = fp2_equal(f, one);
+
+    for (k=0; k<count; k++) {
+	point_clear(S[k]);
+	if (k) point_clear(minus[k]);
+    }
+    free(minus);
+    free(S);
+    free(key);
+    free(L);
+    fp2_clear(f); fp2_clear(one);
+    point_clear(R);
+    mpz_clear(r);
+    return result;
+}
+
+static void BLS_bisect_batch(int *valid, int *index, int n, point_t *sig,
+	point_t *H, point_t *pub, byte_string_t *pubkey, params_t params)
+//the batch index[0...n-1] is known to contain a bad signature:
+//check each half, and look inside the halves that fail
+//valid[] is set for every signature in the batch
+{
+    int i;
+    int half = n / 2;
+
+    if (n == 1) {
+	valid[index[0]] = 0;
+	return;
+    }
+    if (BLS_check_batch(NULL, index, half, sig, H, pub, pubkey, params)) {
+	//then the bad one is in the second half
+	for (i=0; i<half; i++) valid[index[i]] = 1;
+    } else {
+	BLS_bisect_batch(valid, index, half, sig, H, pub, pubkey, params);
+	if (BLS_check_batch(NULL, index + half, n - half,
+		    sig, H, pub, pubkey, params)) {
+	    for (i=half; i<n; i++) valid[index[i]] = 1;
+	    return;
+	}
+    }
+    BLS_bisect_batch(valid, index + half, n - half,
+	    sig, H, pub, pubkey, params);
+}
+
+int BLS_verify_batch(int *valid, byte_string_t *sig,
+	byte_string_t *message, byte_string_t *pubkey, int n, params_t params)
+{
+    int i, m;
+    int result = 1;
+    int *index;
+    point_t *S, *H, *X;
+
+    S = (point_t *) malloc(sizeof(point_t) * n);
+    H = (point_t *) malloc(sizeof(point_t) * n);
+    X = (point_t *) malloc(sizeof(point_t) * n);
+    index = (int *) malloc(sizeof(int) * (n + 1));
+
+    //signatures and keys that can't be combined (e.g. points at infinity)
+    //are checked on their own
+    m = 0;
+    for (i=0; i<n; i++) {
+	point_init(S[i]);
+	point_init(H[i]);
+	point_init(X[i]);
+	point_set_byte_string(S[i], sig[i]);
+	point_set_byte_string(X[i], pubkey[i]);
+	if (!S[i]->infinity && !X[i]->infinity) {
+	    map_byte_string_to_point(H[i], message[i], params);
+	    index[m] = i;
+	    m++;
+	    if (valid) valid[i] = 1;
+	} else {
+	    int ok = BLS_verify(sig[i], message[i], pubkey[i], params);
+	    if (valid) valid[i] = ok;
+	    if (!ok) result = 0;
+	}
+    }
+
+    if (m && !BLS_check_batch(NULL, index, m, S, H, X, pubkey, params)) {
+	result = 0;
+	if (valid) BLS_bisect_batch(valid, index, m, S, H, X, pubkey, params);
+    }
+
+    for (i=0; i<n; i++) {
+	point_clear(S[i]);
+	point_clear(H[i]);
+	point_clear(X[i]);
+    }
+    free(S);
+    free(H);
+    free(X);
+    free(index);
+    return result;
+}
+
+void BLS_aggregate(byte_string_t agg, byte_string_t *sig, int n,
+	params_t params)
+{
+    int i;
+    point_t A, S;
+
+    point_init(A);
+    point_init(S);
+    point_set_O(A);
+    for (i=0; i<n; i++) {
+	point_set_byte_string(S, sig[i]);
+	point_add(A, A, S, params->curve);
+    }
+    byte_string_set_point(agg, A);
+    point_clear(A);
+    point_clear(S);
+}
+
+int BLS_aggregate_verify(byte_string_t agg,
+	byte_string_t *message, byte_string_t *pubkey, int n, params_t params)
+//agg is valid when e(P, Phi(agg)) = prod e(pubkey_i, Phi(H(message_i)))
+{
+    int i, j;
+    int result = 1;
+    int *index;
+    point_t A;
+    point_t *H, *X;
+
+    //aggregation is only secure when the messages are distinct
+    for (i=0; i<n; i++) {
+	for (j=0; j<i; j++) {
+	    if (!byte_string_cmp(message[i], message[j])) return 0;
+	}
+    }
+
+    point_init(A);
+    point_set_byte_string(A, agg);
+    H = (point_t *) malloc(sizeof(point_t) * n);
+    X = (point_t *) malloc(sizeof(point_t) * n);
+    index = (int *) malloc(sizeof(int) * (n + 1));
+    for (i=0; i<n; i++) {
+	point_init(H[i]);
+	point_init(X[i]);
+	point_set_byte_string(X[i], pubkey[i]);
+	if (X[i]->infinity) result = 0;
+	map_byte_string_to_point(H[i], message[i], params);
+	index[i] = i;
+    }
+
+    if (result) {
+	result = BLS_check_batch(A, index, n, NULL, H, X, pubkey, params);
+    }
+
+    for (i=0; i<n; i++) {
+	point_clear(H[i]);
+	point_clear(X[i]);
+    }
+    free(H);
+    free(X);
+    free(index);
+    point_clear(A);
+    return result;
+}
+
 //using certificates and BLS we can do identity-based signatures
 void IBE_keygen(byte_string_t privkey, byte_string_t pubkey, params_t params)
 {
@@ -1167,55 +2113,75 @@ void IBE_sign(byte_string_t sig, byte_string_t message, byte_string_t private,
     point_clear(C);
 }
 
-int IBE_verify(byte_string_t sig, byte_string_t message, byte_string_t public,
-	const char *id, params_t params)
+static void cert_pairing(fp2_ptr g, byte_string_t public, const char *id,
+	params_t params)
+//g = e(Ppub, Phi(H(public key, ID))), the factor of the verification
+//equation that does not depend on the message
+//remembered for each signer, as it is the same for all their messages
 {
-    int result;
-
-    point_t P, Q;
-    fp2_t f1, f2, f3;
-
     byte_string_t H;
     byte_string_t bsid;
+    point_t Q;
 
-    fp2_init(f1); fp2_init(f2); fp2_init(f3);
+    byte_string_set(bsid, id);
+    crypto_va_hash(H, 2, public, bsid);
+    byte_string_clear(bsid);
 
-    //compute LHS of equation = e(P, sig)
-    point_init(P);
-    point_set(P, params->P);
+    if (!lru_lookup(params->certcache, H, certcache_copy, g)) {
+	fp2_ptr value;
 
-    point_init(Q);
-    point_set_byte_string(Q, sig);
-    point_Phi(Q, Q, params);
-    tate_pairing(f1, P, Q, params->curve);
+	point_init(Q);
+	map_id_to_point(Q, H, params);
+	point_Phi(Q, Q, params);
+	tate_postprocess(g, params->Ppub_mc, Q, params->curve);
+	point_clear(Q);
 
-    //compute first factor on RHS = e(public key, message)
+	value = (fp2_ptr) malloc(sizeof(fp2_t));
+	fp2_init(value);
+	fp2_set(value, g);
+	lru_insert(params->certcache, H, value, sizeof(fp2_t));
+    }
 
-    point_set_byte_string(P, public);
-    map_byte_string_to_point(Q, message, params);
-    point_Phi(Q, Q, params);
-    tate_pairing(f2, P, Q, params->curve);
+    byte_string_clear(H);
+}
 
-    //compute second factor on RHS = e(server public key, cert plaintext)
-    byte_string_set(bsid, id);
+int IBE_verify(byte_string_t sig, byte_string_t message, byte_string_t public,
+	const char *id, params_t params)
+//the signature is valid when e(P, sig) e(-public key, message) = e(Ppub, cert)
+//the right-hand side is cached, and the left-hand side needs only one
+//full Miller loop as P is preprocessed
+{
+    int result;
 
-    crypto_va_hash(H, 2, public, bsid);
-    map_byte_string_to_point(Q, H, params);
+    point_t P, Q, R;
+    point_ptr L[1], M[1], Rp[1];
+    miller_cache_ptr mc[1];
+    fp2_t f, g;
 
-    byte_string_clear(bsid);
-    byte_string_clear(H);
+    fp2_init(f); fp2_init(g);
+    point_init(P); point_init(Q); point_init(R);
+
+    //e(P, sig)
+    mc[0] = params->P_mc;
+    point_set_byte_string(R, sig);
+    point_Phi(R, R, params);
 
+    //e(-public key, message)
+    point_set_byte_string(P, public);
+    fp2_neg(P->y, P->y, params->p);
+    map_byte_string_to_point(Q, message, params);
     point_Phi(Q, Q, params);
-    tate_pairing(f3, params->Ppub, Q, params->curve);
 
-    fp2_mul(f2, f2, f3, params->p);
+    L[0] = P; M[0] = Q; Rp[0] = R;
+    tate_product_postprocess(f, mc, Rp, 1, L, M, 1, params->curve);
 
-    if (!fp2_equal(f1, f2)) {
-	result = 0;
-    } else result = 1;
+    //e(server public key, cert plaintext)
+    cert_pairing(g, public, id, params);
+
+    result = fp2_equal(f, g);
 
-    point_clear(P); point_clear(Q);
-    fp2_clear(f1); fp2_clear(f2); fp2_clear(f3);
+    point_clear(P); point_clear(Q); point_clear(R);
+    fp2_clear(f); fp2_clear(g);
 
     return result;
 }
@@ -1285,3 +2251,21 @@ int IBE_reveal_key(byte_string_t K,
 
     return result;
 }
+
+int IBE_reveal_key_preprocessed(byte_string_t K,
+	byte_string_t U, byte_string_t V, preprocessed_key_t pk, params_t params)
+{
+    int result = 1;
+    byte_string_t secret;
+
+    IBE_KEM_decrypt_preprocessed(secret, U, pk, params);
+
+    if (1 != crypto_decrypt(K, V, secret)) {
+	fprintf(stderr, "WARNING: INVALID CIPHERTEXT!\n");
+	result = 0;
+    }
+
+    byte_string_clear(secret);
+
+    return result;
+}
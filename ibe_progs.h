@@ -19,6 +19,7 @@ int combine(int argc, char **argv);
 int imratio(int argc, char **argv);
 
 int extract_share(int argc, char **argv);
+int extract_share_batch(int argc, char **argv);
 
 int extract(int argc, char **argv);
 int certify(int argc, char **argv);
@@ -9,15 +9,116 @@ Copyright (C) 2001 Benjamin Lynn (blynn@cs.stanford.edu)
 See LICENSE for license
 */
 
+#include <stdlib.h>
 #include "get_time.h"
 #include "curve.h"
 #include "format.h"
 #include "ibe_progs.h"
 
 enum {
-    trials = 5000
+    trials = 5000,
+    pairing_trials = 64
 };
 
+static void lanes_bench(fp2_t *a, fp2_t *b)
+//multiplications in F_p^2 by mont.c, then mlanes_n at a time by
+//mont_lanes.c, and tate_postprocess_batch with and without the lanes
+{
+    mont_ptr m = params->curve->mont;
+    mlanes_ptr L = params->curve->lanes;
+    int S = L->size;
+    int groups = trials / mlanes_n;
+    fp2m_t *am, *bm, cm;
+    uint64_t *va, *vb, *vc;
+    mp_ptr pa[mlanes_n], pb[mlanes_n];
+    point_t Q[pairing_trials];
+    point_ptr Qp[pairing_trials];
+    fp2_t r[pairing_trials];
+    int i, l, lanes_ok = params->curve->lanes_ok;
+    double t0, t1, M, ML;
+
+    am = (fp2m_t *) malloc(sizeof(fp2m_t) * trials);
+    bm = (fp2m_t *) malloc(sizeof(fp2m_t) * trials);
+    va = (uint64_t *) malloc(sizeof(uint64_t) * 2 * S * groups);
+    vb = (uint64_t *) malloc(sizeof(uint64_t) * 2 * S * groups);
+    vc = (uint64_t *) malloc(sizeof(uint64_t) * 2 * S);
+    for (i=0; i<trials; i++) {
+	fp2m_set_fp2(am[i], a[i], m);
+	fp2m_set_fp2(bm[i], b[i], m);
+    }
+    for (i=0; i<groups; i++) {
+	for (l=0; l<mlanes_n; l++) {
+	    pa[l] = am[i * mlanes_n + l]->a;
+	    pb[l] = bm[i * mlanes_n + l]->a;
+	}
+	mlanes_set_mont(va + 2 * i * S, (mp_srcptr *) pa, mlanes_n, L);
+	mlanes_set_mont(vb + 2 * i * S, (mp_srcptr *) pb, mlanes_n, L);
+	for (l=0; l<mlanes_n; l++) {
+	    pa[l] = am[i * mlanes_n + l]->b;
+	    pb[l] = bm[i * mlanes_n + l]->b;
+	}
+	mlanes_set_mont(va + (2 * i + 1) * S, (mp_srcptr *) pa, mlanes_n, L);
+	mlanes_set_mont(vb + (2 * i + 1) * S, (mp_srcptr *) pb, mlanes_n, L);
+    }
+
+    printf("F_p^2 multiplications, %d at a time (%s)\n", mlanes_n,
+	    mlanes_ifma() ? "AVX-512 IFMA" : "portable");
+    t0 = get_time();
+    for (i=0; i<trials; i++) {
+	fp2m_mul(cm, am[i], bm[i], m);
+    }
+    t1 = get_time();
+    M = t1 - t0;
+    printf("%d M (Montgomery) = %f\n", trials, M);
+
+    t0 = get_time();
+    for (i=0; i<groups; i++) {
+	mlanes_fp2_mul(vc, va + 2 * i * S, vb + 2 * i * S, L);
+    }
+    t1 = get_time();
+    ML = t1 - t0;
+    printf("%d M (lanes) = %f\n", groups * mlanes_n, ML);
+    printf("speedup = %f\n", M / ML);
+
+    printf("Pairings with a preprocessed point\n");
+    for (i=0; i<pairing_trials; i++) {
+	point_init(Q[i]);
+	fp2_init(r[i]);
+	Qp[i] = Q[i];
+	point_random(Q[i], params->curve);
+	fp2_mul(Q[i]->x, Q[i]->x, params->zeta, params->p);
+    }
+
+    params->curve->lanes_ok = 0;
+    t0 = get_time();
+    tate_postprocess_batch(r, params->Ppub_mc, Qp, pairing_trials,
+	    params->curve);
+    t1 = get_time();
+    M = t1 - t0;
+    printf("%d batched = %f\n", pairing_trials, M);
+
+    if (lanes_ok) {
+	params->curve->lanes_ok = 1;
+	t0 = get_time();
+	tate_postprocess_batch(r, params->Ppub_mc, Qp, pairing_trials,
+		params->curve);
+	t1 = get_time();
+	ML = t1 - t0;
+	printf("%d batched (lanes) = %f\n", pairing_trials, ML);
+	printf("speedup = %f\n", M / ML);
+    }
+
+    for (i=0; i<pairing_trials; i++) {
+	point_clear(Q[i]);
+	fp2_clear(r[i]);
+    }
+    free(am);
+    free(bm);
+    free(va);
+    free(vb);
+    free(vc);
+}
+
 int imratio(int argc, char **argv)
 {
     int i;
@@ -73,6 +174,8 @@ int imratio(int argc, char **argv)
 
     printf("I/M = %f\n", I/M);
 
+    lanes_bench(a, b);
+
     printf("F_p operations\n");
 
     t0 = get_time();
@@ -0,0 +1,253 @@
+/* Least-recently-used caches keyed by byte strings
+ */
+/*
+See LICENSE for license
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "lru.h"
+
+struct lru_entry_s {
+    byte_string_t key;
+    unsigned int hash;
+    void *value;
+    size_t size;
+    unsigned long hits;
+    int refs; //number of lru_acquire() calls not yet released
+    int removed; //no longer in the cache, free when refs drops to 0
+    struct lru_entry_s *next; //next in the same bucket
+    struct lru_entry_s *prev_use, *next_use; //recency list
+};
+
+static unsigned int lru_hash(byte_string_t key)
+//FNV-1a
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i=0; i<key->len; i++) {
+	h ^= key->data[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+static void lru_alloc_buckets(lru_t c, int maxcount)
+//a bucket per entry, rounded up to a power of 2
+{
+    lru_entry_ptr e, next;
+    lru_entry_ptr *old = c->bucket;
+    int oldcount = c->bucketcount;
+    int i, n = 16;
+
+    while (n < maxcount) n <<= 1;
+
+    c->bucket = (lru_entry_ptr *) calloc(n, sizeof(lru_entry_ptr));
+    c->bucketcount = n;
+
+    for (i=0; i<oldcount; i++) {
+	for (e=old[i]; e; e=next) {
+	    next = e->next;
+	    e->next = c->bucket[e->hash & (n - 1)];
+	    c->bucket[e->hash & (n - 1)] = e;
+	}
+    }
+    free(old);
+}
+
+static void lru_unlink(lru_t c, lru_entry_ptr e)
+//take e out of the recency list
+{
+    if (e->prev_use) e->prev_use->next_use = e->next_use;
+    else c->head = e->next_use;
+    if (e->next_use) e->next_use->prev_use = e->prev_use;
+    else c->tail = e->prev_use;
+}
+
+static void lru_push_front(lru_t c, lru_entry_ptr e)
+//make e the most recently used entry
+{
+    e->prev_use = NULL;
+    e->next_use = c->head;
+    if (c->head) c->head->prev_use = e;
+    else c->tail = e;
+    c->head = e;
+}
+
+static void lru_free_entry(lru_t c, lru_entry_ptr e)
+{
+    c->free_value(e->value);
+    byte_string_clear(e->key);
+    free(e);
+}
+
+static void lru_remove(lru_t c, lru_entry_ptr e)
+//take e out of the cache and free it, unless it is still acquired
+{
+    lru_entry_ptr *pp = &c->bucket[e->hash & (c->bucketcount - 1)];
+
+    while (*pp != e) pp = &(*pp)->next;
+    *pp = e->next;
+    lru_unlink(c, e);
+
+    c->count--;
+    c->bytes -= e->size;
+    if (e->refs) e->removed = 1;
+    else lru_free_entry(c, e);
+}
+
+static void lru_evict(lru_t c)
+//drop least recently used entries until the limits hold
+{
+    while (c->tail && (c->count > c->maxcount
+		|| (c->maxbytes && c->bytes > c->maxbytes))) {
+	lru_remove(c, c->tail);
+	c->evictions++;
+    }
+}
+
+static lru_entry_ptr lru_find(lru_t c, byte_string_t key, unsigned int h)
+{
+    lru_entry_ptr e;
+
+    for (e=c->bucket[h & (c->bucketcount - 1)]; e; e=e->next) {
+	if (e->hash == h && !byte_string_cmp(e->key, key)) return e;
+    }
+    return NULL;
+}
+
+void lru_init(lru_t c, int maxcount, size_t maxbytes, lru_freefn free_value)
+{
+    pthread_mutex_init(&c->lock, NULL);
+    c->bucket = NULL;
+    c->bucketcount = 0;
+    lru_alloc_buckets(c, maxcount);
+    c->head = c->tail = NULL;
+    c->count = 0;
+    c->maxcount = maxcount;
+    c->bytes = 0;
+    c->maxbytes = maxbytes;
+    c->free_value = free_value;
+    c->hits = c->misses = c->evictions = 0;
+}
+
+void lru_clear(lru_t c)
+//entries must all have been released
+{
+    while (c->head) lru_remove(c, c->head);
+    free(c->bucket);
+    pthread_mutex_destroy(&c->lock);
+}
+
+void lru_resize(lru_t c, int maxcount, size_t maxbytes)
+{
+    pthread_mutex_lock(&c->lock);
+    c->maxcount = maxcount;
+    c->maxbytes = maxbytes;
+    lru_evict(c);
+    if (maxcount > c->bucketcount) lru_alloc_buckets(c, maxcount);
+    pthread_mutex_unlock(&c->lock);
+}
+
+int lru_lookup(lru_t c, byte_string_t key, lru_copyfn copy, void *dst)
+{
+    lru_entry_ptr e;
+    unsigned int h = lru_hash(key);
+
+    pthread_mutex_lock(&c->lock);
+    e = lru_find(c, key, h);
+    if (!e) {
+	c->misses++;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+    }
+    c->hits++;
+    e->hits++;
+    lru_unlink(c, e);
+    lru_push_front(c, e);
+    copy(dst, e->value);
+    pthread_mutex_unlock(&c->lock);
+    return 1;
+}
+
+lru_entry_ptr lru_acquire(lru_t c, byte_string_t key, unsigned long *hits)
+{
+    lru_entry_ptr e;
+    unsigned int h = lru_hash(key);
+
+    pthread_mutex_lock(&c->lock);
+    e = lru_find(c, key, h);
+    if (!e) {
+	c->misses++;
+    } else {
+	c->hits++;
+	e->hits++;
+	e->refs++;
+	if (hits) *hits = e->hits;
+	lru_unlink(c, e);
+	lru_push_front(c, e);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return e;
+}
+
+void *lru_entry_value(lru_entry_ptr e)
+{
+    return e->value;
+}
+
+void lru_release(lru_t c, lru_entry_ptr e)
+{
+    pthread_mutex_lock(&c->lock);
+    e->refs--;
+    if (!e->refs && e->removed) lru_free_entry(c, e);
+    pthread_mutex_unlock(&c->lock);
+}
+
+void lru_insert(lru_t c, byte_string_t key, void *value, size_t size)
+{
+    lru_entry_ptr e;
+    unsigned long hits = 0;
+    unsigned int h = lru_hash(key);
+
+    pthread_mutex_lock(&c->lock);
+    if (c->maxcount <= 0 || (c->maxbytes && size > c->maxbytes)) {
+	pthread_mutex_unlock(&c->lock);
+	c->free_value(value);
+	return;
+    }
+    e = lru_find(c, key, h);
+    if (e) {
+	hits = e->hits;
+	lru_remove(c, e);
+    }
+
+    e = (lru_entry_ptr) malloc(sizeof(struct lru_entry_s));
+    byte_string_copy(e->key, key);
+    e->hash = h;
+    e->value = value;
+    e->size = size;
+    e->hits = hits;
+    e->refs = 0;
+    e->removed = 0;
+    e->next = c->bucket[h & (c->bucketcount - 1)];
+    c->bucket[h & (c->bucketcount - 1)] = e;
+    lru_push_front(c, e);
+    c->count++;
+    c->bytes += size;
+
+    lru_evict(c);
+    pthread_mutex_unlock(&c->lock);
+}
+
+void lru_stats(lru_t c, unsigned long *hits, unsigned long *misses,
+	unsigned long *evictions, int *count, size_t *bytes)
+{
+    pthread_mutex_lock(&c->lock);
+    if (hits) *hits = c->hits;
+    if (misses) *misses = c->misses;
+    if (evictions) *evictions = c->evictions;
+    if (count) *count = c->count;
+    if (bytes) *bytes = c->bytes;
+    pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,88 @@
+/* Least-recently-used caches keyed by byte strings
+ * header file
+ */
+/*
+See LICENSE for license
+*/
+#ifndef LRU_H
+#define LRU_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "byte_string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//a cache maps byte strings to values it owns
+//it holds at most maxcount entries and (if maxbytes is nonzero)
+//at most maxbytes bytes worth of values, as reported by lru_insert()
+//the least recently used entries are evicted first
+//every routine locks the cache, so one cache can be shared by threads
+
+typedef void (*lru_freefn)(void *value);
+//releases a value when it leaves the cache
+
+typedef void (*lru_copyfn)(void *dst, void *value);
+//copies a value out of the cache (called with the cache locked)
+
+struct lru_entry_s;
+typedef struct lru_entry_s *lru_entry_ptr;
+
+struct lru_s {
+    pthread_mutex_t lock;
+    struct lru_entry_s **bucket;
+    int bucketcount; //power of 2
+    struct lru_entry_s *head, *tail; //most recently used at head
+    int count, maxcount;
+    size_t bytes, maxbytes;
+    lru_freefn free_value;
+    unsigned long hits, misses, evictions;
+};
+
+typedef struct lru_s lru_t[1];
+typedef struct lru_s *lru_ptr;
+
+void lru_init(lru_t c, int maxcount, size_t maxbytes, lru_freefn free_value);
+//call before using c
+//maxcount = 0 means nothing is ever cached
+
+void lru_clear(lru_t c);
+//frees c and every value in it
+
+void lru_resize(lru_t c, int maxcount, size_t maxbytes);
+//change the limits, evicting entries if necessary
+
+int lru_lookup(lru_t c, byte_string_t key, lru_copyfn copy, void *dst);
+//if key is present, copy(dst, value), mark it as recently used
+//and return 1, otherwise return 0
+
+lru_entry_ptr lru_acquire(lru_t c, byte_string_t key, unsigned long *hits);
+//like lru_lookup, but instead of copying the value returns its entry
+//(or NULL), which stays valid until lru_release() even if evicted
+//use this for values too big to copy
+//if hits is not NULL it is set to the number of times the entry
+//has been found, including this time
+
+void *lru_entry_value(lru_entry_ptr e);
+//the value held by an acquired entry
+
+void lru_release(lru_t c, lru_entry_ptr e);
+//done with an entry returned by lru_acquire()
+
+void lru_insert(lru_t c, byte_string_t key, void *value, size_t size);
+//add key -> value, where value occupies size bytes
+//if key is already present its old value is replaced
+//the cache takes ownership of value (it is freed immediately
+//if it cannot fit)
+
+void lru_stats(lru_t c, unsigned long *hits, unsigned long *misses,
+	unsigned long *evictions, int *count, size_t *bytes);
+//read the counters, any pointer may be NULL
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LRU_H
@@ -0,0 +1,761 @@
+/* Montgomery arithmetic in F_p and F_p^2
+ * uses the mpn layer of GMP on fixed-length limb arrays
+ * so no memory is allocated in the inner loops
+ */
+/*
+See LICENSE for license
+*/
+#include <stdlib.h>
+#include "mont.h"
+
+enum {
+    //constants for sliding window algorithms
+    windowsize = 5,
+    windowsizepower = 15,	    //this is 2^(windowsize - 1) - 1
+    //exponents up to this many bits are recoded on the stack
+    wnaf_maxbits = 2 * mont_maxbits,
+    //fixed-base tables: each window of fixedwindow bits stores
+    //g^(k 2^(fixedwindow j)) for 1 <= k <= fixedpower
+    fixedwindow = 4,
+    fixedpower = 8,		    //this is 2^(fixedwindow - 1)
+    //in-place batch inversions of up to this many entries keep
+    //their prefix products on the stack
+    batch_inv_stack = 16
+};
+
+int mont_init(mont_t m, mpz_t p)
+//set up Montgomery arithmetic modulo p
+{
+    mp_size_t n = mpz_size(p);
+    mp_limb_t inv;
+    mp_limb_t t[3 * mont_maxlimbs + 1];
+    mp_limb_t q[2 * mont_maxlimbs + 1];
+    int i;
+
+    if (n == 0 || n > mont_maxlimbs || mpz_even_p(p)) {
+	m->n = 0;
+	return 0;
+    }
+
+    m->n = n;
+    mpn_copyi(m->p, mpz_limbs_read(p), n);
+
+    //Newton iteration for 1/p mod 2^GMP_NUMB_BITS
+    //(p is its own inverse mod 8, then each step doubles the precision)
+    inv = m->p[0];
+    for (i=0; i<6; i++) {
+	inv *= 2 - m->p[0] * inv;
+    }
+    m->pinv = -inv;
+
+    //R^k mod p for k = 1, 2, 3
+    mpn_zero(t, n);
+    t[n] = 1;
+    mpn_tdiv_qr(q, m->one, 0, t, n + 1, m->p, n);
+    mpn_zero(t, 2 * n);
+    t[2 * n] = 1;
+    mpn_tdiv_qr(q, m->r2, 0, t, 2 * n + 1, m->p, n);
+    mpn_zero(t, 3 * n);
+    t[3 * n] = 1;
+    mpn_tdiv_qr(q, m->r3, 0, t, 3 * n + 1, m->p, n);
+
+    mpn_sqr(m->p2, m->p, n);
+
+    return 1;
+}
+
+static mp_limb_t redc_loop(mp_ptr t, mont_ptr m)
+//adds multiples of p to t to zero its low n limbs, and returns
+//the carry out of its top n limbs
+//the carry of each row lands where the zeroed limb was, and all of
+//them are added in at the end, rather than rippled up row by row
+{
+    mp_size_t i, n = m->n;
+
+    for (i=0; i<n; i++) {
+	t[i] = mpn_addmul_1(t + i, m->p, n, t[i] * m->pinv);
+    }
+    return mpn_add_n(t + n, t + n, t, n);
+}
+
+static void mont_redc(mp_ptr x, mp_ptr t, mont_ptr m)
+//x = t / R mod p
+//t has 2n limbs, must be less than pR, and is destroyed
+{
+    mp_size_t n = m->n;
+    mp_limb_t hi = redc_loop(t, m);
+
+    //now t / R = hi * R + (top half of t) < 2p
+    if (hi || mpn_cmp(t + n, m->p, n) >= 0) {
+	mpn_sub_n(x, t + n, m->p, n);
+    } else {
+	mpn_copyi(x, t + n, n);
+    }
+}
+
+static void mont_redc_wide(mp_ptr x, mp_ptr t, mont_ptr m)
+//x = t / R mod p
+//t has 2n + 1 limbs and is destroyed
+{
+    mp_size_t n = m->n;
+    mp_limb_t hi = t[2 * n];
+    mp_limb_t q[2];
+
+    hi += redc_loop(t, m);
+    if (!hi && mpn_cmp(t + n, m->p, n) < 0) {
+	mpn_copyi(x, t + n, n);
+	return;
+    }
+    //long accumulations can leave several multiples of p
+    t[2 * n] = hi;
+    mpn_tdiv_qr(q, x, 0, t + n, n + 1, m->p, n);
+}
+
+void mont_mul(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m)
+//x = a * b
+{
+    mp_limb_t t[2 * mont_maxlimbs];
+
+    if (a == b) {
+	mpn_sqr(t, a, m->n);
+    } else {
+	mpn_mul_n(t, a, b, m->n);
+    }
+    mont_redc(x, t, m);
+}
+
+void mont_sqr(mp_ptr x, mp_srcptr a, mont_ptr m)
+//x = a * a
+{
+    mp_limb_t t[2 * mont_maxlimbs];
+
+    mpn_sqr(t, a, m->n);
+    mont_redc(x, t, m);
+}
+
+void mont_set_mpz(mp_ptr x, mpz_t a, mont_ptr m)
+//x = aR mod p
+{
+    mp_size_t n = m->n;
+    mp_size_t s = mpz_size(a);
+    mp_limb_t t[mont_maxlimbs];
+
+    if (mpz_sgn(a) < 0 || s > n) {
+	//unusual case: bring a into range first
+	mpz_ptr r = zp_scratch_get();
+	mpz_t pz;
+	mpz_mod(r, a, mpz_roinit_n(pz, m->p, n));
+	mont_set_mpz(x, r, m);
+	fp2_scratch_put(1);
+	return;
+    }
+
+    //any a < R works since REDC only needs aR^2 < pR
+    mpn_copyi(t, mpz_limbs_read(a), s);
+    mpn_zero(t + s, n - s);
+    mont_mul(x, t, m->r2, m);
+}
+
+void mont_get_mpz(mpz_t a, mp_srcptr x, mont_ptr m)
+//a = x / R mod p
+{
+    mp_size_t n = m->n;
+    mp_limb_t t[2 * mont_maxlimbs];
+
+    mpn_copyi(t, x, n);
+    mpn_zero(t + n, n);
+    mont_redc(mpz_limbs_write(a, n), t, m);
+    mpz_limbs_finish(a, n);
+}
+
+void mont_set_0(mp_ptr x, mont_ptr m)
+//x = 0
+{
+    mpn_zero(x, m->n);
+}
+
+void mont_set_1(mp_ptr x, mont_ptr m)
+//x = 1
+{
+    mpn_copyi(x, m->one, m->n);
+}
+
+void mont_set(mp_ptr x, mp_srcptr a, mont_ptr m)
+//x = a
+{
+    if (x != a) mpn_copyi(x, a, m->n);
+}
+
+int mont_is_0(mp_srcptr x, mont_ptr m)
+//x == 0?
+{
+    return mpn_zero_p(x, m->n);
+}
+
+int mont_equal(mp_srcptr x, mp_srcptr y, mont_ptr m)
+//x == y?
+{
+    return !mpn_cmp(x, y, m->n);
+}
+
+void mont_add(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m)
+//x = a + b
+{
+    mp_size_t n = m->n;
+
+    if (mpn_add_n(x, a, b, n) || mpn_cmp(x, m->p, n) >= 0) {
+	mpn_sub_n(x, x, m->p, n);
+    }
+}
+
+void mont_sub(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m)
+//x = a - b
+{
+    mp_size_t n = m->n;
+
+    if (mpn_sub_n(x, a, b, n)) {
+	mpn_add_n(x, x, m->p, n);
+    }
+}
+
+void mont_neg(mp_ptr x, mp_srcptr a, mont_ptr m)
+//x = -a
+{
+    if (mpn_zero_p(a, m->n)) {
+	mpn_zero(x, m->n);
+    } else {
+	mpn_sub_n(x, m->p, a, m->n);
+    }
+}
+
+void mont_half(mp_ptr x, mp_srcptr a, mont_ptr m)
+//x = a / 2
+//(halving commutes with the Montgomery representation)
+{
+    mp_size_t n = m->n;
+    mp_limb_t c;
+
+    if (a[0] & 1) {
+	c = mpn_add_n(x, a, m->p, n);
+	mpn_rshift(x, x, n, 1);
+	x[n - 1] |= c << (GMP_NUMB_BITS - 1);
+    } else {
+	mpn_rshift(x, a, n, 1);
+    }
+}
+
+void mont_inv(mp_ptr x, mp_srcptr a, mont_ptr m)
+//x = 1 / a
+//GMP has no allocation-free inverse so this goes through mpz_invert
+{
+    mp_size_t n = m->n;
+    mp_limb_t t[mont_maxlimbs];
+    mpz_ptr z;
+    mpz_t az, pz;
+    mp_size_t s;
+
+    z = zp_scratch_get();
+    if (!mpz_invert(z, mpz_roinit_n(az, a, n), mpz_roinit_n(pz, m->p, n))) {
+	//a = 0
+	mpn_zero(x, n);
+	fp2_scratch_put(1);
+	return;
+    }
+    //z = 1/(aR), so multiplying by R^3 in Montgomery form gives R/a
+    s = mpz_size(z);
+    mpn_copyi(t, mpz_limbs_read(z), s);
+    mpn_zero(t + s, n - s);
+    mont_mul(x, t, m->r3, m);
+    fp2_scratch_put(1);
+}
+
+void mont_batch_inv(mp_ptr x, mp_srcptr a, int count, mont_ptr m)
+//x_i = 1 / a_i for 0 <= i < count, where x_i is x + i * n etc.
+//Montgomery's trick: one inversion and 3(count - 1) multiplications
+{
+    mp_size_t n = m->n;
+    mp_limb_t inv[mont_maxlimbs], t[mont_maxlimbs];
+    mp_limb_t prebuf[batch_inv_stack * mont_maxlimbs];
+    mp_ptr pre;
+    int i;
+
+    if (count <= 0) return;
+
+    //pre_i = a_0 ... a_(i-1), skipping zeros
+    //x can hold these unless it is also the input
+    if (x != a) {
+	pre = x;
+    } else if (count <= batch_inv_stack) {
+	pre = prebuf;
+    } else {
+	pre = (mp_ptr) malloc(sizeof(mp_limb_t) * n * count);
+    }
+
+    mont_set_1(inv, m);
+    for (i=0; i<count; i++) {
+	mont_set(pre + i * n, inv, m);
+	if (!mont_is_0(a + i * n, m)) {
+	    if (i) mont_mul(inv, inv, a + i * n, m);
+	    else mont_set(inv, a, m);
+	}
+    }
+
+    mont_inv(inv, inv, m);
+
+    //now walk back: inv = 1 / (a_0 ... a_i)
+    //zeros are mapped to zero as in mont_inv()
+    for (i=count-1; i>=0; i--) {
+	if (mont_is_0(a + i * n, m)) {
+	    mont_set_0(x + i * n, m);
+	    continue;
+	}
+	mont_mul(t, inv, pre + i * n, m);
+	if (i) mont_mul(inv, inv, a + i * n, m);
+	mont_set(x + i * n, t, m);
+    }
+
+    if (pre != x && pre != prebuf) free(pre);
+}
+
+void fp2m_set_fp2(fp2m_ptr x, fp2_ptr a, mont_ptr m)
+//x = a in Montgomery form
+{
+    mont_set_mpz(x->a, a->a, m);
+    mont_set_mpz(x->b, a->b, m);
+}
+
+void fp2m_get_fp2(fp2_ptr a, fp2m_ptr x, mont_ptr m)
+//a = x converted out of Montgomery form
+{
+    mont_get_mpz(a->a, x->a, m);
+    mont_get_mpz(a->b, x->b, m);
+}
+
+void fp2m_set(fp2m_ptr x, fp2m_ptr a, mont_ptr m)
+//x = a
+{
+    if (x == a) return;
+    mpn_copyi(x->a, a->a, m->n);
+    mpn_copyi(x->b, a->b, m->n);
+}
+
+void fp2m_set_1(fp2m_ptr x, mont_ptr m)
+//x = 1
+{
+    mont_set_1(x->a, m);
+    mont_set_0(x->b, m);
+}
+
+int fp2m_equal(fp2m_ptr x, fp2m_ptr y, mont_ptr m)
+//x == y?
+{
+    return mont_equal(x->a, y->a, m) && mont_equal(x->b, y->b, m);
+}
+
+void fp2m_add(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m)
+//x = a + b
+{
+    mont_add(x->a, a->a, b->a, m);
+    mont_add(x->b, a->b, b->b, m);
+}
+
+void fp2m_sub(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m)
+//x = a - b
+{
+    mont_sub(x->a, a->a, b->a, m);
+    mont_sub(x->b, a->b, b->b, m);
+}
+
+void fp2m_conj(fp2m_ptr x, fp2m_ptr a, mont_ptr m)
+//x = a^p
+{
+    mont_set(x->a, a->a, m);
+    mont_neg(x->b, a->b, m);
+}
+
+void fp2m_mul_mont(fp2m_ptr x, fp2m_ptr a, mp_srcptr b, mont_ptr m)
+//x = a * b, b in F_p
+{
+    mont_mul(x->a, a->a, b, m);
+    mont_mul(x->b, a->b, b, m);
+}
+
+void fp2m_mul(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m)
+//x = a * b
+//Karatsuba on double-width products, so there are 3 multiplications
+//and only one reduction per coordinate
+{
+    mp_size_t n = m->n;
+    mp_limb_t t0[2 * mont_maxlimbs], t1[2 * mont_maxlimbs];
+    mp_limb_t t2[2 * mont_maxlimbs];
+    mp_limb_t s[mont_maxlimbs], u[mont_maxlimbs];
+    mp_limb_t c;
+
+    mont_add(s, a->a, a->b, m);
+    mont_add(u, b->a, b->b, m);
+    mpn_mul_n(t0, a->a, b->a, n);
+    mpn_mul_n(t1, a->b, b->b, n);
+    mpn_mul_n(t2, s, u, n);
+
+    //imaginary part: t2 - t0 - t1 = a0 b1 + a1 b0 mod p
+    //this can be negative (s, u were reduced) so add pR
+    //until it is not; the result lies in [0, pR) as REDC needs
+    c = mpn_sub_n(t2, t2, t0, 2 * n);
+    c += mpn_sub_n(t2, t2, t1, 2 * n);
+    while (c) {
+	c -= mpn_add_n(t2 + n, t2 + n, m->p, n);
+    }
+
+    //real part: t0 - t1 > -p^2 > -pR
+    if (mpn_sub_n(t0, t0, t1, 2 * n)) {
+	mpn_add_n(t0 + n, t0 + n, m->p, n);
+    }
+
+    mont_redc(x->a, t0, m);
+    mont_redc(x->b, t2, m);
+}
+
+void fp2m_sqr(fp2m_ptr x, fp2m_ptr a, mont_ptr m)
+//x = a * a
+{
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs], t2[mont_maxlimbs];
+
+    mont_add(t0, a->a, a->b, m);
+    mont_sub(t1, a->a, a->b, m);
+    mont_mul(t2, a->a, a->b, m);
+    mont_mul(x->a, t0, t1, m);
+    mont_add(x->b, t2, t2, m);
+}
+
+void fp2m_acc_set_0(fp2m_acc_ptr acc, mont_ptr m)
+//acc = 0
+{
+    mpn_zero(acc->a, 2 * m->n + 1);
+    mpn_zero(acc->b, 2 * m->n + 1);
+}
+
+static void acc_add(mp_ptr acc, mp_srcptr t, mont_ptr m)
+//acc += t where t has 2n limbs
+{
+    mp_size_t n2 = 2 * m->n;
+
+    acc[n2] += mpn_add_n(acc, acc, t, n2);
+}
+
+static void acc_sub(mp_ptr acc, mp_srcptr t, mont_ptr m)
+//acc -= t where t has 2n limbs
+//callers make sure the true value stays nonnegative
+{
+    mp_size_t n2 = 2 * m->n;
+
+    acc[n2] -= mpn_sub_n(acc, acc, t, n2);
+}
+
+void fp2m_acc_addmul(fp2m_acc_ptr acc, fp2m_ptr a, fp2m_ptr b, mont_ptr m)
+//acc += a * b without reduction
+//the p^2 terms keep both coordinates nonnegative
+{
+    mp_size_t n = m->n;
+    mp_limb_t t0[2 * mont_maxlimbs], t1[2 * mont_maxlimbs];
+    mp_limb_t t2[2 * mont_maxlimbs];
+    mp_limb_t s[mont_maxlimbs], u[mont_maxlimbs];
+
+    mont_add(s, a->a, a->b, m);
+    mont_add(u, b->a, b->b, m);
+    mpn_mul_n(t0, a->a, b->a, n);
+    mpn_mul_n(t1, a->b, b->b, n);
+    mpn_mul_n(t2, s, u, n);
+
+    //real part += t0 - t1 + p^2
+    acc_add(acc->a, t0, m);
+    acc_add(acc->a, m->p2, m);
+    acc_sub(acc->a, t1, m);
+
+    //imaginary part += t2 - t0 - t1 + 2p^2
+    acc_add(acc->b, t2, m);
+    acc_add(acc->b, m->p2, m);
+    acc_add(acc->b, m->p2, m);
+    acc_sub(acc->b, t0, m);
+    acc_sub(acc->b, t1, m);
+}
+
+void fp2m_acc_addmul_mont(fp2m_acc_ptr acc, fp2m_ptr a, mp_srcptr b, mont_ptr m)
+//acc += a * b without reduction, b in F_p
+{
+    mp_size_t n = m->n;
+    mp_limb_t t[2 * mont_maxlimbs];
+
+    mpn_mul_n(t, a->a, b, n);
+    acc_add(acc->a, t, m);
+    mpn_mul_n(t, a->b, b, n);
+    acc_add(acc->b, t, m);
+}
+
+void fp2m_acc_reduce(fp2m_ptr x, fp2m_acc_ptr acc, mont_ptr m)
+//x = acc / R mod p
+{
+    mont_redc_wide(x->a, acc->a, m);
+    mont_redc_wide(x->b, acc->b, m);
+}
+
+void fp2m_pow(fp2m_ptr res, fp2m_ptr x, mpz_t n, mont_ptr m)
+//res = x^n
+//uses sliding-window method
+{
+    int i, j, k, l, t;
+    fp2m_t g[2*windowsizepower+2];
+
+    fp2m_set(g[1], x, m);
+    fp2m_sqr(g[2], x, m);
+    for (i=1; i<=windowsizepower; i++) {
+	j = 2 * i + 1;
+	fp2m_mul(g[j], g[j - 2], g[2], m);
+    }
+
+    t = mpz_sizeinbase(n, 2) - 1;
+    fp2m_set_1(res, m);
+
+    while(t>=0) {
+	if (!mpz_tstbit(n, t)) {
+	    fp2m_sqr(res, res, m);
+	    t--;
+	} else {
+	    l = t - windowsize + 1;
+	    if (l < 0) l = 0;
+	    l = mpz_scan1(n, l);
+	    j = 1;
+	    fp2m_sqr(res, res, m);
+	    for (k = t - 1; k>=l; k--) {
+		j = j << 1;
+		if (mpz_tstbit(n, k)) j++;
+		fp2m_sqr(res, res, m);
+	    }
+	    fp2m_mul(res, res, g[j], m);
+	    t = l-1;
+	}
+    }
+}
+
+void fp2m_inv(fp2m_ptr x, fp2m_ptr a, mont_ptr m)
+//x = 1 / a = conj(a) / (a^2 + b^2)
+{
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs];
+
+    mont_sqr(t0, a->a, m);
+    mont_sqr(t1, a->b, m);
+    mont_add(t0, t0, t1, m);
+    mont_inv(t0, t0, m);
+    mont_mul(x->a, a->a, t0, m);
+    mont_mul(x->b, a->b, t0, m);
+    mont_neg(x->b, x->b, m);
+}
+
+void fp2m_batch_inv(fp2m_ptr x, fp2m_ptr a, int count, mont_ptr m)
+//x[i] = 1 / a[i] for 0 <= i < count
+//mont_batch_inv() on the norms, then conj(a[i]) / N(a[i]) as in fp2m_inv()
+{
+    mp_size_t n = m->n;
+    mp_limb_t t[mont_maxlimbs];
+    mp_ptr norm, ninv;
+    int i;
+
+    if (count <= 0) return;
+
+    norm = (mp_ptr) malloc(sizeof(mp_limb_t) * 2 * n * count);
+    ninv = norm + n * count;
+    for (i=0; i<count; i++) {
+	mont_sqr(norm + i * n, a[i].a, m);
+	mont_sqr(t, a[i].b, m);
+	mont_add(norm + i * n, norm + i * n, t, m);
+    }
+
+    mont_batch_inv(ninv, norm, count, m);
+
+    for (i=0; i<count; i++) {
+	mont_mul(x[i].a, a[i].a, ninv + i * n, m);
+	mont_mul(x[i].b, a[i].b, ninv + i * n, m);
+	mont_neg(x[i].b, x[i].b, m);
+    }
+    free(norm);
+}
+
+void fp2m_sqr_unitary(fp2m_ptr x, fp2m_ptr a, mont_ptr m)
+//x = a * a
+//since a^2 + b^2 = 1 the result is (2a^2 - 1) + ((a + b)^2 - 1)i
+//which needs two squarings rather than two general multiplications
+{
+    mp_limb_t t0[mont_maxlimbs], t1[mont_maxlimbs];
+
+    mont_sqr(t0, a->a, m);
+    mont_add(t1, a->a, a->b, m);
+    mont_sqr(t1, t1, m);
+    mont_sub(x->b, t1, m->one, m);
+    mont_add(t0, t0, t0, m);
+    mont_sub(x->a, t0, m->one, m);
+}
+
+static int wnaf_recode(signed char *d, mpz_t n, int w)
+//width-w NAF of n >= 0, least significant digit first
+//digits are 0 or odd with absolute value less than 2^(w-1)
+//returns the number of digits
+{
+    int i = 0, j;
+    int len = mpz_sizeinbase(n, 2);
+    int carry = 0;
+    int val;
+
+    if (!mpz_sgn(n)) return 0;
+
+    while (i < len || carry) {
+	if (((int) mpz_tstbit(n, i) + carry) % 2 == 0) {
+	    carry = ((int) mpz_tstbit(n, i) + carry) >> 1;
+	    d[i++] = 0;
+	    continue;
+	}
+	val = carry;
+	for (j=0; j<w; j++) {
+	    val += (int) mpz_tstbit(n, i + j) << j;
+	}
+	if (val > (1 << (w - 1))) {
+	    d[i] = val - (1 << w);
+	    carry = 1;
+	} else {
+	    d[i] = val;
+	    carry = 0;
+	}
+	for (j=1; j<w; j++) d[i + j] = 0;
+	i += w;
+    }
+    //trailing zeros may have been written past the top
+    while (!d[i - 1]) i--;
+    return i;
+}
+
+void fp2m_pow_unitary(fp2m_ptr res, fp2m_ptr x, mpz_t n, mont_ptr m)
+//res = x^n for x of norm 1
+//signed sliding window: negative digits use the conjugate,
+//so only odd positive powers x, x^3, ..., x^(2^(w-1) - 1) are stored
+{
+    int i, k;
+    int t;
+    fp2m_t g[(windowsizepower + 1) / 2];
+    fp2m_t x2, c;
+    signed char buf[wnaf_maxbits + windowsize + 1];
+    signed char *d = buf;
+
+    if (mpz_sizeinbase(n, 2) > wnaf_maxbits) {
+	d = (signed char *) malloc(mpz_sizeinbase(n, 2) + windowsize + 1);
+    }
+    t = wnaf_recode(d, n, windowsize);
+
+    fp2m_set(g[0], x, m);
+    fp2m_sqr_unitary(x2, x, m);
+    for (i=1; i<(windowsizepower + 1) / 2; i++) {
+	fp2m_mul(g[i], g[i - 1], x2, m);
+    }
+
+    fp2m_set_1(res, m);
+    for (i=t-1; i>=0; i--) {
+	fp2m_sqr_unitary(res, res, m);
+	k = d[i];
+	if (k > 0) {
+	    fp2m_mul(res, res, g[k >> 1], m);
+	} else if (k < 0) {
+	    fp2m_conj(c, g[(-k) >> 1], m);
+	    fp2m_mul(res, res, c, m);
+	}
+    }
+
+    if (d != buf) free(d);
+}
+
+static int fixed_windows(int bits)
+//number of windows needed for exponents of up to bits bits
+//(one extra for the carry out of signed recoding)
+{
+    return (bits + fixedwindow - 1) / fixedwindow + 1;
+}
+
+size_t fp2m_fixed_limbs(int bits, mont_ptr m)
+//number of limbs in a table for fp2m_fixed_pow_unitary()
+{
+    return (size_t) fixed_windows(bits) * fixedpower * 2 * m->n;
+}
+
+static void fixed_get(fp2m_ptr x, mp_srcptr table, int i, mont_ptr m)
+//x = table entry i
+{
+    mp_size_t n = m->n;
+    mpn_copyi(x->a, table + 2 * i * n, n);
+    mpn_copyi(x->b, table + (2 * i + 1) * n, n);
+}
+
+static void fixed_put(mp_ptr table, int i, fp2m_ptr x, mont_ptr m)
+//table entry i = x
+{
+    mp_size_t n = m->n;
+    mpn_copyi(table + 2 * i * n, x->a, n);
+    mpn_copyi(table + (2 * i + 1) * n, x->b, n);
+}
+
+void fp2m_fixed_init(mp_ptr table, fp2m_ptr g, int bits, mont_ptr m)
+//fill table for g, which has norm 1
+//costs fixedwindow squarings and fixedpower - 1 multiplications per window
+{
+    int i, j, k;
+    int t = fixed_windows(bits);
+    fp2m_t x, y;
+
+    fp2m_set(x, g, m);
+    for (j=0; j<t; j++) {
+	if (j) {
+	    for (i=0; i<fixedwindow; i++) fp2m_sqr_unitary(x, x, m);
+	}
+	fixed_put(table, j * fixedpower, x, m);
+	fp2m_set(y, x, m);
+	for (k=1; k<fixedpower; k++) {
+	    fp2m_mul(y, y, x, m);
+	    fixed_put(table, j * fixedpower + k, y, m);
+	}
+    }
+}
+
+void fp2m_fixed_pow_unitary(fp2m_ptr res, mp_srcptr table, int bits,
+	mpz_t n, mont_ptr m)
+//res = g^n, where table was filled by fp2m_fixed_init(table, g, bits, m)
+//n is recoded into signed digits in [-fixedpower + 1, fixedpower],
+//so each window costs at most one multiplication and no squarings
+{
+    int i, j;
+    int t = fixed_windows(bits);
+    int carry = 0;
+    int d;
+    fp2m_t x;
+
+    if (mpz_sgn(n) < 0 || mpz_sizeinbase(n, 2) > (size_t) bits) {
+	fixed_get(x, table, 0, m);
+	fp2m_pow_unitary(res, x, n, m);
+	return;
+    }
+
+    fp2m_set_1(res, m);
+    for (j=0; j<t; j++) {
+	d = carry;
+	for (i=0; i<fixedwindow; i++) {
+	    d += (int) mpz_tstbit(n, j * fixedwindow + i) << i;
+	}
+	if (d > fixedpower) {
+	    d -= 1 << fixedwindow;
+	    carry = 1;
+	} else carry = 0;
+
+	if (d > 0) {
+	    fixed_get(x, table, j * fixedpower + d - 1, m);
+	    fp2m_mul(res, res, x, m);
+	} else if (d < 0) {
+	    fixed_get(x, table, j * fixedpower - d - 1, m);
+	    fp2m_conj(x, x, m);
+	    fp2m_mul(res, res, x, m);
+	}
+    }
+}
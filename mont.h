@@ -0,0 +1,200 @@
+/* Montgomery arithmetic in F_p and F_p^2
+ * header file
+ */
+/*
+See LICENSE for license
+*/
+#ifndef MONT_H
+#define MONT_H
+
+#include <gmp.h>
+#include "fp2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    //largest modulus the fixed-width routines handle
+    mont_maxbits = 4096,
+    mont_maxlimbs = mont_maxbits / GMP_NUMB_BITS
+};
+
+//an element of F_p is held as n = mont->n limbs in Montgomery form,
+//i.e. x is stored as xR mod p where R = 2^(n * GMP_NUMB_BITS)
+//all routines below assume their F_p arguments are in {0,...,p-1}
+//and work on the first n limbs of each array only
+
+struct mont_s {
+    mp_size_t n;
+    mp_limb_t p[mont_maxlimbs];
+    mp_limb_t pinv; //-1/p mod 2^GMP_NUMB_BITS
+    mp_limb_t one[mont_maxlimbs]; //R mod p
+    mp_limb_t r2[mont_maxlimbs]; //R^2 mod p
+    mp_limb_t r3[mont_maxlimbs]; //R^3 mod p
+    mp_limb_t p2[2 * mont_maxlimbs]; //p^2
+};
+
+typedef struct mont_s mont_t[1];
+typedef struct mont_s *mont_ptr;
+
+//for F_p^2 we use the same representation as fp2.h
+struct fp2m_s {
+    mp_limb_t a[mont_maxlimbs], b[mont_maxlimbs];
+};
+
+typedef struct fp2m_s fp2m_t[1];
+typedef struct fp2m_s *fp2m_ptr;
+
+//double-width accumulator for sums of products in F_p^2
+//products are added without reduction, and the sum is
+//reduced once at the end by fp2m_acc_reduce()
+struct fp2m_acc_s {
+    mp_limb_t a[2 * mont_maxlimbs + 1], b[2 * mont_maxlimbs + 1];
+};
+
+typedef struct fp2m_acc_s fp2m_acc_t[1];
+typedef struct fp2m_acc_s *fp2m_acc_ptr;
+
+int mont_init(mont_t m, mpz_t p);
+//set up Montgomery arithmetic modulo p
+//needs no matching clear since nothing is allocated
+//returns 0 if p is even or has more than mont_maxbits bits
+
+void mont_set_mpz(mp_ptr x, mpz_t a, mont_ptr m);
+//x = a in Montgomery form
+
+void mont_get_mpz(mpz_t a, mp_srcptr x, mont_ptr m);
+//a = x converted out of Montgomery form
+
+void mont_set_0(mp_ptr x, mont_ptr m);
+//x = 0
+
+void mont_set_1(mp_ptr x, mont_ptr m);
+//x = 1
+
+void mont_set(mp_ptr x, mp_srcptr a, mont_ptr m);
+//x = a
+
+int mont_is_0(mp_srcptr x, mont_ptr m);
+//returns true if x equals 0, false otherwise
+
+int mont_equal(mp_srcptr x, mp_srcptr y, mont_ptr m);
+//returns true if x equals y, false otherwise
+
+void mont_add(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m);
+//x = a + b
+
+void mont_sub(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m);
+//x = a - b
+
+void mont_neg(mp_ptr x, mp_srcptr a, mont_ptr m);
+//x = -a
+
+void mont_half(mp_ptr x, mp_srcptr a, mont_ptr m);
+//x = a / 2
+
+void mont_mul(mp_ptr x, mp_srcptr a, mp_srcptr b, mont_ptr m);
+//x = a * b
+
+void mont_sqr(mp_ptr x, mp_srcptr a, mont_ptr m);
+//x = a * a
+
+void mont_inv(mp_ptr x, mp_srcptr a, mont_ptr m);
+//x = 1 / a
+
+void mont_batch_inv(mp_ptr x, mp_srcptr a, int count, mont_ptr m);
+//x_i = 1 / a_i for 0 <= i < count, where x_i denotes x + i * n
+//(so x and a each point to count * n limbs)
+//costs one inversion and 3(count - 1) multiplications
+//zero entries are left as zero, x may equal a
+
+void fp2m_set_fp2(fp2m_ptr x, fp2_ptr a, mont_ptr m);
+//x = a in Montgomery form
+
+void fp2m_get_fp2(fp2_ptr a, fp2m_ptr x, mont_ptr m);
+//a = x converted out of Montgomery form
+
+void fp2m_set(fp2m_ptr x, fp2m_ptr a, mont_ptr m);
+//x = a
+
+void fp2m_set_1(fp2m_ptr x, mont_ptr m);
+//x = 1
+
+int fp2m_equal(fp2m_ptr x, fp2m_ptr y, mont_ptr m);
+//returns true if x equals y, false otherwise
+
+void fp2m_add(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m);
+//x = a + b
+
+void fp2m_sub(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m);
+//x = a - b
+
+void fp2m_conj(fp2m_ptr x, fp2m_ptr a, mont_ptr m);
+//x = conjugate of a (= a^p)
+
+void fp2m_mul_mont(fp2m_ptr x, fp2m_ptr a, mp_srcptr b, mont_ptr m);
+//x = a * b where b lies in F_p
+
+void fp2m_mul(fp2m_ptr x, fp2m_ptr a, fp2m_ptr b, mont_ptr m);
+//x = a * b
+//Karatsuba: 3 multiplications, one reduction per coordinate
+
+void fp2m_sqr(fp2m_ptr x, fp2m_ptr a, mont_ptr m);
+//x = a * a
+//2 multiplications, one reduction per coordinate
+
+void fp2m_acc_set_0(fp2m_acc_ptr acc, mont_ptr m);
+//acc = 0
+
+void fp2m_acc_addmul(fp2m_acc_ptr acc, fp2m_ptr a, fp2m_ptr b, mont_ptr m);
+//acc += a * b, unreduced
+
+void fp2m_acc_addmul_mont(fp2m_acc_ptr acc, fp2m_ptr a, mp_srcptr b, mont_ptr m);
+//acc += a * b where b lies in F_p, unreduced
+
+void fp2m_acc_reduce(fp2m_ptr x, fp2m_acc_ptr acc, mont_ptr m);
+//x = acc reduced mod p (and out of the double-width representation)
+//acc is destroyed
+
+void fp2m_inv(fp2m_ptr x, fp2m_ptr a, mont_ptr m);
+//x = 1 / a
+
+void fp2m_batch_inv(fp2m_ptr x, fp2m_ptr a, int count, mont_ptr m);
+//x[i] = 1 / a[i] for 0 <= i < count
+//costs one inversion, as mont_batch_inv()
+
+void fp2m_pow(fp2m_ptr res, fp2m_ptr x, mpz_t n, mont_ptr m);
+//res = x^n
+
+//the following assume their argument has norm 1, i.e. a^2 + b^2 = 1,
+//as is the case for outputs of the Tate pairing
+//for these 1/x = conjugate of x
+
+void fp2m_sqr_unitary(fp2m_ptr x, fp2m_ptr a, mont_ptr m);
+//x = a * a, a of norm 1
+
+void fp2m_pow_unitary(fp2m_ptr res, fp2m_ptr x, mpz_t n, mont_ptr m);
+//res = x^n, x of norm 1, n >= 0
+//uses signed windows since negative digits cost only a conjugation
+
+//fixed-base exponentiation: when the same x is raised to many
+//exponents, a table of its powers saves all the squarings
+//the table is held in a plain limb array of fp2m_fixed_limbs() limbs
+
+size_t fp2m_fixed_limbs(int bits, mont_ptr m);
+//number of limbs in a table for exponents of up to bits bits
+
+void fp2m_fixed_init(mp_ptr table, fp2m_ptr x, int bits, mont_ptr m);
+//fill in the table for x, x of norm 1
+
+void fp2m_fixed_pow_unitary(fp2m_ptr res, mp_srcptr table, int bits,
+	mpz_t n, mont_ptr m);
+//res = x^n, where the table was filled in for x and bits
+//n >= 0, falls back to fp2m_pow_unitary() if n has more than bits bits
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MONT_H
@@ -0,0 +1,490 @@
+/* Montgomery arithmetic in F_p and F_p^2 on several elements at once
+ * each call works on mlanes_n independent elements, e.g. for
+ * pairings of many points with one preprocessed point
+ * with AVX-512 IFMA a multiplication of mlanes_n elements costs about
+ * as much as two with the mpn layer, otherwise the same arithmetic
+ * is done one word at a time (which is slower than mont.c)
+ */
+/*
+See LICENSE for license
+*/
+#include <string.h>
+#include "mont_lanes.h"
+
+#if MLANES_IFMA
+#include <immintrin.h>
+#define IFMA __attribute__((target("avx512f,avx512ifma")))
+#endif
+
+#define MASK52 ((((uint64_t) 1) << mlanes_radix) - 1)
+
+static int mlanes_fast = 0; //whether the CPU has AVX-512 IFMA
+
+static void mpn_to_digits(uint64_t *x, mp_srcptr a, mp_size_t n, int k)
+//x[j * mlanes_n] = digit j of a in radix 2^52, for 0 <= j < k
+{
+    int i, j;
+    int bit = 0;
+    uint64_t d;
+
+    for (j=0; j<k; j++) {
+	i = bit / 64;
+	d = 0;
+	if (i < n) {
+	    d = a[i] >> (bit % 64);
+	    if (bit % 64 > 64 - mlanes_radix && i + 1 < n) {
+		d |= a[i + 1] << (64 - bit % 64);
+	    }
+	}
+	x[j * mlanes_n] = d & MASK52;
+	bit += mlanes_radix;
+    }
+}
+
+static void digits_to_mpn(mp_ptr x, mp_size_t n, uint64_t *a, int k)
+//x = the number whose radix 2^52 digits are a[j * mlanes_n]
+//the digits must be below 2^52 and the number below 2^(64n)
+{
+    int i, j;
+    int bit = 0;
+
+    mpn_zero(x, n);
+    for (j=0; j<k; j++) {
+	i = bit / 64;
+	if (i < n) {
+	    x[i] |= a[j * mlanes_n] << (bit % 64);
+	    if (bit % 64 > 64 - mlanes_radix && i + 1 < n) {
+		x[i + 1] |= a[j * mlanes_n] >> (64 - bit % 64);
+	    }
+	}
+	bit += mlanes_radix;
+    }
+}
+
+static void mpz_to_digits(uint64_t *x, mpz_t a, int k)
+//x[j] = digit j of a in radix 2^52
+{
+    uint64_t t[mlanes_maxdigits * mlanes_n];
+    int j;
+
+    mpn_to_digits(t, mpz_limbs_read(a), mpz_size(a), k);
+    for (j=0; j<k; j++) x[j] = t[j * mlanes_n];
+}
+
+static void spread_digits(uint64_t *x, uint64_t *a, mlanes_ptr L)
+//every element of x = the number whose digits are a[j]
+{
+    int j, l;
+
+    for (j=0; j<L->k; j++) {
+	for (l=0; l<mlanes_n; l++) x[j * mlanes_n + l] = a[j];
+    }
+}
+
+#if MLANES_IFMA
+
+static void IFMA normalize_ifma(__m512i *t, int k)
+//propagate carries so each digit is below 2^52
+//digits may be negative, in which case so may the top one end up
+{
+    __m512i mask = _mm512_set1_epi64(MASK52);
+    int j;
+
+    for (j=0; j<k-1; j++) {
+	t[j + 1] = _mm512_add_epi64(t[j + 1], _mm512_srai_epi64(t[j], mlanes_radix));
+	t[j] = _mm512_and_si512(t[j], mask);
+    }
+}
+
+static void IFMA reduce_ifma(uint64_t *x, __m512i *t, mlanes_ptr L)
+//x = t - 2p for those elements where that is not negative, t otherwise
+//t must be normalized and nonnegative
+{
+    __m512i s[mlanes_maxdigits];
+    __m512i mask = _mm512_set1_epi64(MASK52);
+    __m512i c = _mm512_setzero_si512();
+    __mmask8 keep;
+    int j, k = L->k;
+
+    for (j=0; j<k; j++) {
+	s[j] = _mm512_add_epi64(c, _mm512_sub_epi64(t[j],
+		    _mm512_set1_epi64(L->p2[j])));
+	c = _mm512_srai_epi64(s[j], mlanes_radix);
+	s[j] = _mm512_and_si512(s[j], mask);
+    }
+    keep = _mm512_cmplt_epi64_mask(c, _mm512_setzero_si512());
+    for (j=0; j<k; j++) {
+	_mm512_storeu_si512(x + j * mlanes_n,
+		_mm512_mask_blend_epi64(keep, s[j], t[j]));
+    }
+}
+
+static void IFMA mlanes_add_ifma(uint64_t *x, uint64_t *a, uint64_t *b,
+	mlanes_ptr L)
+{
+    __m512i t[mlanes_maxdigits];
+    int j, k = L->k;
+
+    for (j=0; j<k; j++) {
+	t[j] = _mm512_add_epi64(_mm512_loadu_si512(a + j * mlanes_n),
+		_mm512_loadu_si512(b + j * mlanes_n));
+    }
+    normalize_ifma(t, k);
+    reduce_ifma(x, t, L);
+}
+
+static void IFMA mlanes_sub_ifma(uint64_t *x, uint64_t *a, uint64_t *b,
+	mlanes_ptr L)
+//a - b + 2p lies in {0,...,4p}
+{
+    __m512i t[mlanes_maxdigits];
+    int j, k = L->k;
+
+    for (j=0; j<k; j++) {
+	t[j] = _mm512_sub_epi64(_mm512_add_epi64(
+		    _mm512_loadu_si512(a + j * mlanes_n),
+		    _mm512_set1_epi64(L->p2[j])),
+		_mm512_loadu_si512(b + j * mlanes_n));
+    }
+    normalize_ifma(t, k);
+    reduce_ifma(x, t, L);
+}
+
+static void IFMA mlanes_mul_ifma(uint64_t *x, uint64_t *a, uint64_t *b,
+	mlanes_ptr L)
+//word-by-word Montgomery multiplication, one digit of b at a time
+//each accumulator gains at most 4k terms below 2^52 before it
+//is shifted out, so none of them overflow
+{
+    __m512i t[mlanes_maxdigits + 1];
+    __m512i zero = _mm512_setzero_si512();
+    __m512i pinv = _mm512_set1_epi64(L->pinv);
+    __m512i bi, aj, pj, m;
+    int i, j, k = L->k;
+
+    for (j=0; j<=k; j++) t[j] = zero;
+    for (i=0; i<k; i++) {
+	bi = _mm512_loadu_si512(b + i * mlanes_n);
+	for (j=0; j<k; j++) {
+	    aj = _mm512_loadu_si512(a + j * mlanes_n);
+	    t[j] = _mm512_madd52lo_epu64(t[j], aj, bi);
+	    t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], aj, bi);
+	}
+	m = _mm512_madd52lo_epu64(zero, t[0], pinv);
+	for (j=0; j<k; j++) {
+	    pj = _mm512_set1_epi64(L->p[j]);
+	    t[j] = _mm512_madd52lo_epu64(t[j], m, pj);
+	    t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], m, pj);
+	}
+	//the low 52 bits of t[0] are now 0
+	t[1] = _mm512_add_epi64(t[1], _mm512_srli_epi64(t[0], mlanes_radix));
+	for (j=0; j<k; j++) t[j] = t[j + 1];
+	t[k] = zero;
+    }
+    //the result is below 2p, see mont_lanes.h
+    normalize_ifma(t, k);
+    for (j=0; j<k; j++) {
+	_mm512_storeu_si512(x + j * mlanes_n, t[j]);
+    }
+}
+
+#endif //MLANES_IFMA
+
+static void mul52(uint64_t *hi, uint64_t *lo, uint64_t a, uint64_t b)
+//hi 2^52 + lo = a * b for a, b below 2^52
+{
+    uint64_t a0 = a & 0x3ffffff, a1 = a >> 26;
+    uint64_t b0 = b & 0x3ffffff, b1 = b >> 26;
+    uint64_t mid = a0 * b1 + a1 * b0;
+    uint64_t t = a0 * b0 + ((mid & 0x3ffffff) << 26);
+
+    *hi = a1 * b1 + (mid >> 26) + (t >> mlanes_radix);
+    *lo = t & MASK52;
+}
+
+static void normalize_c(int64_t *t, int k)
+{
+    int j;
+
+    for (j=0; j<k-1; j++) {
+	t[j + 1] += t[j] >> mlanes_radix;
+	t[j] &= MASK52;
+    }
+}
+
+static void reduce_c(uint64_t *x, int64_t *t, uint64_t *q, int k)
+//x = t - q if that is not negative, t otherwise
+{
+    int64_t s[mlanes_maxdigits];
+    int64_t c = 0;
+    int j;
+
+    for (j=0; j<k; j++) {
+	s[j] = t[j] - (int64_t) q[j] + c;
+	c = s[j] >> mlanes_radix;
+	s[j] &= MASK52;
+    }
+    for (j=0; j<k; j++) {
+	x[j * mlanes_n] = c < 0 ? t[j] : s[j];
+    }
+}
+
+static void mlanes_add_c(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+    int64_t t[mlanes_maxdigits];
+    int j, l, k = L->k;
+
+    for (l=0; l<mlanes_n; l++) {
+	for (j=0; j<k; j++) {
+	    t[j] = a[j * mlanes_n + l] + b[j * mlanes_n + l];
+	}
+	normalize_c(t, k);
+	reduce_c(x + l, t, L->p2, k);
+    }
+}
+
+static void mlanes_sub_c(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+    int64_t t[mlanes_maxdigits];
+    int j, l, k = L->k;
+
+    for (l=0; l<mlanes_n; l++) {
+	for (j=0; j<k; j++) {
+	    t[j] = (int64_t) (a[j * mlanes_n + l] + L->p2[j])
+		- (int64_t) b[j * mlanes_n + l];
+	}
+	normalize_c(t, k);
+	reduce_c(x + l, t, L->p2, k);
+    }
+}
+
+static void mlanes_mul_c(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+//as mlanes_mul_ifma(), one element at a time
+{
+    int64_t t[mlanes_maxdigits + 1];
+    uint64_t hi, lo, m;
+    int i, j, l, k = L->k;
+
+    for (l=0; l<mlanes_n; l++) {
+	for (j=0; j<=k; j++) t[j] = 0;
+	for (i=0; i<k; i++) {
+	    for (j=0; j<k; j++) {
+		mul52(&hi, &lo, a[j * mlanes_n + l], b[i * mlanes_n + l]);
+		t[j] += lo;
+		t[j + 1] += hi;
+	    }
+	    mul52(&hi, &m, t[0] & MASK52, L->pinv);
+	    for (j=0; j<k; j++) {
+		mul52(&hi, &lo, m, L->p[j]);
+		t[j] += lo;
+		t[j + 1] += hi;
+	    }
+	    t[1] += (uint64_t) t[0] >> mlanes_radix;
+	    for (j=0; j<k; j++) t[j] = t[j + 1];
+	    t[k] = 0;
+	}
+	normalize_c(t, k);
+	for (j=0; j<k; j++) x[j * mlanes_n + l] = t[j];
+    }
+}
+
+int mlanes_init(mlanes_t L, mont_ptr m)
+{
+    mpz_t p, z, r;
+    uint64_t inv;
+    int i;
+    int bits;
+
+    mpz_init(z);
+    mpz_init(r);
+    mpz_roinit_n(p, m->p, m->n);
+    bits = mpz_sizeinbase(p, 2);
+    if (bits > mlanes_maxbits) {
+	mpz_clear(z);
+	mpz_clear(r);
+	return 0;
+    }
+
+#if MLANES_IFMA
+    mlanes_fast = __builtin_cpu_supports("avx512ifma") != 0;
+#endif
+
+    L->mont = m;
+    L->k = (bits + 2 + mlanes_radix - 1) / mlanes_radix;
+    L->size = L->k * mlanes_n;
+    mpz_to_digits(L->p, p, L->k);
+    mpz_mul_2exp(z, p, 1);
+    mpz_to_digits(L->p2, z, L->k);
+
+    //Newton iteration for 1/p mod 2^52, as in mont_init()
+    inv = L->p[0];
+    for (i=0; i<6; i++) {
+	inv *= 2 - L->p[0] * inv;
+    }
+    L->pinv = -inv & MASK52;
+
+    //R mod p, then R^2 / R' mod p and R' mod p
+    mpz_set_ui(r, 1);
+    mpz_mul_2exp(r, r, mlanes_radix * L->k);
+    mpz_mod(z, r, p);
+    mpz_to_digits(L->one, z, L->k);
+    mpz_mul(r, r, r);
+    mpz_set_ui(z, 1);
+    mpz_mul_2exp(z, z, GMP_NUMB_BITS * m->n);
+    mpz_invert(z, z, p);
+    mpz_mul(z, z, r);
+    mpz_mod(z, z, p);
+    mpz_to_digits(L->in, z, L->k);
+    mpz_set_ui(z, 1);
+    mpz_mul_2exp(z, z, GMP_NUMB_BITS * m->n);
+    mpz_mod(z, z, p);
+    mpz_to_digits(L->out, z, L->k);
+
+    mpz_clear(z);
+    mpz_clear(r);
+    return 1;
+}
+
+int mlanes_ifma(void)
+{
+    return mlanes_fast;
+}
+
+void mlanes_set_mont(uint64_t *x, mp_srcptr *a, int count, mlanes_ptr L)
+//from xR' to xR with one multiplication by R^2 / R'
+{
+    uint64_t c[mlanes_maxdigits * mlanes_n];
+    int j, l;
+
+    for (l=0; l<mlanes_n; l++) {
+	if (l < count) {
+	    mpn_to_digits(x + l, a[l], L->mont->n, L->k);
+	} else {
+	    for (j=0; j<L->k; j++) x[j * mlanes_n + l] = 0;
+	}
+    }
+    spread_digits(c, L->in, L);
+    mlanes_mul(x, x, c, L);
+}
+
+void mlanes_get_mont(mp_ptr *x, uint64_t *a, int count, mlanes_ptr L)
+//from xR to xR' with one multiplication by R', then subtract p if needed
+//(before packing the digits, as 2p may not fit in mont->n limbs)
+{
+    uint64_t c[mlanes_maxdigits * mlanes_n];
+    uint64_t t[mlanes_maxdigits * mlanes_n];
+    int64_t d[mlanes_maxdigits];
+    int j, l, k = L->k;
+
+    spread_digits(c, L->out, L);
+    mlanes_mul(t, a, c, L);
+    for (l=0; l<count; l++) {
+	for (j=0; j<k; j++) d[j] = t[j * mlanes_n + l];
+	reduce_c(t + l, d, L->p, k);
+	digits_to_mpn(x[l], L->mont->n, t + l, k);
+    }
+}
+
+void mlanes_spread(uint64_t *x, uint64_t *a, int l, mlanes_ptr L)
+{
+    uint64_t d[mlanes_maxdigits];
+    int j;
+
+    for (j=0; j<L->k; j++) d[j] = a[j * mlanes_n + l];
+    spread_digits(x, d, L);
+}
+
+void mlanes_set_1(uint64_t *x, mlanes_ptr L)
+{
+    spread_digits(x, L->one, L);
+}
+
+void mlanes_add(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+#if MLANES_IFMA
+    if (mlanes_fast) {
+	mlanes_add_ifma(x, a, b, L);
+	return;
+    }
+#endif
+    mlanes_add_c(x, a, b, L);
+}
+
+void mlanes_sub(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+#if MLANES_IFMA
+    if (mlanes_fast) {
+	mlanes_sub_ifma(x, a, b, L);
+	return;
+    }
+#endif
+    mlanes_sub_c(x, a, b, L);
+}
+
+void mlanes_mul(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+#if MLANES_IFMA
+    if (mlanes_fast) {
+	mlanes_mul_ifma(x, a, b, L);
+	return;
+    }
+#endif
+    mlanes_mul_c(x, a, b, L);
+}
+
+void mlanes_fp2_conj(uint64_t *x, uint64_t *a, mlanes_ptr L)
+{
+    uint64_t zero[mlanes_maxdigits * mlanes_n];
+
+    memset(zero, 0, sizeof(uint64_t) * L->size);
+    if (x != a) memcpy(x, a, sizeof(uint64_t) * L->size);
+    mlanes_sub(x + L->size, zero, a + L->size, L);
+}
+
+void mlanes_fp2_mul(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L)
+{
+    uint64_t t0[mlanes_maxdigits * mlanes_n];
+    uint64_t t1[mlanes_maxdigits * mlanes_n];
+    uint64_t s[mlanes_maxdigits * mlanes_n];
+    uint64_t u[mlanes_maxdigits * mlanes_n];
+    int n = L->size;
+
+    mlanes_add(s, a, a + n, L);
+    mlanes_add(u, b, b + n, L);
+    mlanes_mul(t0, a, b, L);
+    mlanes_mul(t1, a + n, b + n, L);
+    mlanes_mul(s, s, u, L);
+    mlanes_sub(x, t0, t1, L);
+    mlanes_sub(s, s, t0, L);
+    mlanes_sub(x + n, s, t1, L);
+}
+
+void mlanes_fp2_sqr(uint64_t *x, uint64_t *a, mlanes_ptr L)
+//(a + bi)^2 = (a + b)(a - b) + 2abi
+{
+    uint64_t s[mlanes_maxdigits * mlanes_n];
+    uint64_t d[mlanes_maxdigits * mlanes_n];
+    int n = L->size;
+
+    mlanes_add(s, a, a + n, L);
+    mlanes_sub(d, a, a + n, L);
+    mlanes_mul(x + n, a, a + n, L);
+    mlanes_add(x + n, x + n, x + n, L);
+    mlanes_mul(x, s, d, L);
+}
+
+void mlanes_fp2_sqr_unitary(uint64_t *x, uint64_t *a, mlanes_ptr L)
+{
+    uint64_t t0[mlanes_maxdigits * mlanes_n];
+    uint64_t t1[mlanes_maxdigits * mlanes_n];
+    uint64_t one[mlanes_maxdigits * mlanes_n];
+    int n = L->size;
+
+    mlanes_set_1(one, L);
+    mlanes_mul(t0, a, a, L);
+    mlanes_add(t1, a, a + n, L);
+    mlanes_mul(t1, t1, t1, L);
+    mlanes_sub(x + n, t1, one, L);
+    mlanes_add(t0, t0, t0, L);
+    mlanes_sub(x, t0, one, L);
+}
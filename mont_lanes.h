@@ -0,0 +1,108 @@
+/* Montgomery arithmetic in F_p and F_p^2 on several elements at once
+ * header file
+ */
+/*
+See LICENSE for license
+*/
+#ifndef MONT_LANES_H
+#define MONT_LANES_H
+
+#include <stdint.h>
+#include "mont.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the kernels use AVX-512 IFMA (52-bit multiply-accumulate), which
+//only x86-64 compilers that understand target attributes can emit
+//whether the CPU has it is checked at run time by mlanes_init()
+#if defined(__x86_64__) && defined(__GNUC__) && GMP_NUMB_BITS == 64 \
+	&& !defined(NO_MLANES)
+#define MLANES_IFMA 1
+#else
+#define MLANES_IFMA 0
+#endif
+
+enum {
+    mlanes_n = 8, //elements handled at once
+    mlanes_radix = 52, //bits per digit
+    //largest modulus handled
+    mlanes_maxbits = 1536,
+    //digits per element: 2 bits are spare, so that values below 2p
+    //can be multiplied without reducing them first
+    mlanes_maxdigits = (mlanes_maxbits + 2 + mlanes_radix - 1) / mlanes_radix
+};
+
+//a vector of mlanes_n elements of F_p is held in size = k * mlanes_n
+//words: digit j of element l is word j * mlanes_n + l, and the digits
+//hold xR mod p in radix 2^52 where R = 2^(52k)
+//elements may be anywhere in {0,...,2p} (not necessarily reduced)
+//a vector over F_p^2 is two vectors over F_p, a then b, in 2 * size words
+//in the routines below any of the arguments may be the same vector
+
+struct mlanes_s {
+    int k; //digits per element
+    int size; //words per vector
+    mont_ptr mont;
+    uint64_t p[mlanes_maxdigits], p2[mlanes_maxdigits]; //p and 2p
+    uint64_t pinv; //-1/p mod 2^52
+    uint64_t one[mlanes_maxdigits]; //R mod p
+    uint64_t in[mlanes_maxdigits]; //R^2 / R' mod p, R' as in mont.h
+    uint64_t out[mlanes_maxdigits]; //R' mod p
+};
+
+typedef struct mlanes_s mlanes_t[1];
+typedef struct mlanes_s *mlanes_ptr;
+
+int mlanes_init(mlanes_t L, mont_ptr m);
+//set up arithmetic modulo the p of m
+//needs no matching clear since nothing is allocated
+//returns 0 if p has more than mlanes_maxbits bits
+
+int mlanes_ifma(void);
+//returns 1 if the routines below use AVX-512 IFMA (checked by
+//mlanes_init), otherwise they work a word at a time, which is
+//correct but slower than calling mont.c for each element
+
+void mlanes_set_mont(uint64_t *x, mp_srcptr *a, int count, mlanes_ptr L);
+//element l of x = a[l] (in the Montgomery form of mont.h)
+//for 0 <= l < count, the rest are 0
+void mlanes_get_mont(mp_ptr *x, uint64_t *a, int count, mlanes_ptr L);
+//x[l] = element l of a in the Montgomery form of mont.h
+//for 0 <= l < count
+
+void mlanes_spread(uint64_t *x, uint64_t *a, int l, mlanes_ptr L);
+//every element of x = element l of a
+
+void mlanes_set_1(uint64_t *x, mlanes_ptr L);
+//every element of x = 1
+
+void mlanes_add(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L);
+//x = a + b
+
+void mlanes_sub(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L);
+//x = a - b
+
+void mlanes_mul(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L);
+//x = a * b
+
+void mlanes_fp2_conj(uint64_t *x, uint64_t *a, mlanes_ptr L);
+//x = conjugate of a
+
+void mlanes_fp2_mul(uint64_t *x, uint64_t *a, uint64_t *b, mlanes_ptr L);
+//x = a * b
+//Karatsuba: 3 multiplications in F_p
+
+void mlanes_fp2_sqr(uint64_t *x, uint64_t *a, mlanes_ptr L);
+//x = a * a
+//2 multiplications in F_p
+
+void mlanes_fp2_sqr_unitary(uint64_t *x, uint64_t *a, mlanes_ptr L);
+//x = a * a, each element of a of norm 1, as fp2m_sqr_unitary()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MONT_LANES_H
@@ -8,6 +8,7 @@ See LICENSE for license
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "ibe.h"
@@ -21,6 +22,15 @@ enum {
     test_bls,
     test_sig,
     test_crypto,
+    test_preprocess,
+    test_cache,
+    test_bls_batch,
+    test_bls_aggregate,
+    test_extract_batch,
+    test_params,
+    test_batch_inv,
+    test_multi_mul,
+    test_mul_array,
 
     test_random,
     test_max,
@@ -163,6 +173,146 @@ static int bls_test(params_t params, byte_string_t master)
     return result;
 }
 
+static int bls_batch_test(params_t params, byte_string_t master)
+{
+    enum { count = 6 };
+    byte_string_t priv[2], pub[2];
+    byte_string_t message[count], sig[count], pubkey[count];
+    char s[100];
+    int valid[count];
+    int bad;
+    int i;
+    int result = 1;
+
+    for (i=0; i<2; i++) {
+	BLS_keygen(priv[i], pub[i], params);
+    }
+
+    for (i=0; i<count; i++) {
+	random_charstar(s, 100);
+	byte_string_set(message[i], s);
+	BLS_sign(sig[i], message[i], priv[i % 2], params);
+	byte_string_copy(pubkey[i], pub[i % 2]);
+    }
+
+    if (!BLS_verify_batch(valid, sig, message, pubkey, count, params)) {
+	printf("BUG! bls_batch_test: good batch failed!\n");
+	result = 0;
+    }
+
+    //swap in a signature under the wrong key
+    bad = rand() % count;
+    byte_string_clear(sig[bad]);
+    BLS_sign(sig[bad], message[bad], priv[(bad + 1) % 2], params);
+
+    if (BLS_verify_batch(valid, sig, message, pubkey, count, params)) {
+	printf("BUG! bls_batch_test: bad batch verified!\n");
+	result = 0;
+    }
+    for (i=0; i<count; i++) {
+	if (valid[i] != (i != bad)) {
+	    printf("BUG! bls_batch_test: wrong signature blamed!\n");
+	    result = 0;
+	}
+    }
+
+    for (i=0; i<count; i++) {
+	byte_string_clear(message[i]);
+	byte_string_clear(sig[i]);
+	byte_string_clear(pubkey[i]);
+    }
+    for (i=0; i<2; i++) {
+	byte_string_clear(priv[i]);
+	byte_string_clear(pub[i]);
+    }
+
+    return result;
+}
+
+static int bls_aggregate_test(params_t params, byte_string_t master)
+{
+    enum { count = 5 };
+    byte_string_t priv[count], pub[count];
+    byte_string_t message[count], sig[count];
+    byte_string_t agg;
+    char s[100];
+    int i;
+    int result = 1;
+
+    for (i=0; i<count; i++) {
+	BLS_keygen(priv[i], pub[i], params);
+	sprintf(s, "record %d ", i);
+	random_charstar(s + strlen(s), 50);
+	byte_string_set(message[i], s);
+	BLS_sign(sig[i], message[i], priv[i], params);
+    }
+
+    BLS_aggregate(agg, sig, count, params);
+    if (!BLS_aggregate_verify(agg, message, pub, count, params)) {
+	printf("BUG! bls_aggregate_test failed!\n");
+	result = 0;
+    }
+    byte_string_clear(agg);
+
+    //leave one signature out
+    BLS_aggregate(agg, sig, count - 1, params);
+    if (BLS_aggregate_verify(agg, message, pub, count, params)) {
+	printf("BUG! bls_aggregate_test: incomplete aggregate verified!\n");
+	result = 0;
+    }
+    byte_string_clear(agg);
+
+    for (i=0; i<count; i++) {
+	byte_string_clear(priv[i]);
+	byte_string_clear(pub[i]);
+	byte_string_clear(message[i]);
+	byte_string_clear(sig[i]);
+    }
+
+    return result;
+}
+
+static int extract_batch_test(params_t params, byte_string_t master)
+//the master key with index 1 is a valid master share, whose key share
+//for an ID is (1, the private key)
+{
+    enum { count = 70 };
+    char idbuf[count][100];
+    char *id[count];
+    byte_string_t mshare, kshare[count];
+    byte_string_t bs1, bs2, key;
+    int i, j;
+    int result = 1;
+
+    byte_string_set_int(bs1, 1);
+    byte_string_join(mshare, bs1, master);
+    byte_string_clear(bs1);
+
+    for (i=0; i<count; i++) {
+	random_charstar(idbuf[i], 100);
+	id[i] = idbuf[i];
+    }
+
+    for (j=1; j<=2; j++) {
+	IBE_extract_share_batch(kshare, mshare, id, count, j, params);
+	for (i=0; i<count; i++) {
+	    byte_string_split(bs1, bs2, kshare[i]);
+	    IBE_extract(key, master, id[i], params);
+	    if (int_from_byte_string(bs1) != 1 || byte_string_cmp(bs2, key)) {
+		printf("BUG! extract_batch_test failed!\n");
+		result = 0;
+	    }
+	    byte_string_clear(bs1);
+	    byte_string_clear(bs2);
+	    byte_string_clear(key);
+	    byte_string_clear(kshare[i]);
+	}
+    }
+
+    byte_string_clear(mshare);
+    return result;
+}
+
 static int sig_test(params_t params, byte_string_t master)
 {
     byte_string_t priv, pub;
@@ -229,6 +379,310 @@ static int kem_test(params_t params, byte_string_t master)
 	byte_string_clear(K2);
     }
     byte_string_clear(key);
+
+    //several recipients, more than tate_postprocess_batch takes at once,
+    //some of them already in the gid cache
+    {
+	enum { kem_ids = miller_batch_chunk + 3 };
+	char idbuf[kem_ids][64];
+	char *idarray[kem_ids];
+	byte_string_t Karray[kem_ids];
+
+	for (i=0; i<kem_ids; i++) {
+	    random_charstar(idbuf[i], 64);
+	    idarray[i] = idbuf[i];
+	}
+	idarray[5] = id;
+	IBE_KEM_encrypt_array(Karray, U, idarray, kem_ids, params);
+	for (i=0; i<kem_ids; i++) {
+	    IBE_extract(key, master, idarray[i], params);
+	    IBE_KEM_decrypt(K2, U, key, params);
+	    if (byte_string_cmp(Karray[i], K2)) {
+		//printf("BUG! KEM array is broken!\n");
+		result = 0;
+	    }
+	    byte_string_clear(key);
+	    byte_string_clear(K2);
+	    byte_string_clear(Karray[i]);
+	}
+	byte_string_clear(U);
+    }
+    return result;
+}
+
+static int params_test(params_t params, byte_string_t master)
+{
+    byte_string_t bs, bs2, m2;
+    byte_string_t *bsa;
+    params_t params2;
+    int i, n;
+    int result = 1;
+
+    IBE_serialize_params(bs, params);
+    if (1 != IBE_deserialize_params(params2, bs)) {
+	printf("BUG! deserialize_params failed!\n");
+	result = 0;
+    } else params_clear(params2);
+
+    //a p too wide for Montgomery arithmetic must be rejected
+    byte_string_decode_array(&bsa, &n, bs);
+    byte_string_clear(bsa[2]);
+    byte_string_init(bsa[2], mont_maxbits / 8 + 8);
+    memset(bsa[2]->data, 0xff, bsa[2]->len);
+    byte_string_encode_array(bs2, bsa, n);
+    if (IBE_deserialize_params(params2, bs2)) {
+	printf("BUG! deserialize_params accepted a huge p!\n");
+	params_clear(params2);
+	result = 0;
+    }
+    for (i=0; i<n; i++) {
+	byte_string_clear(bsa[i]);
+    }
+    free(bsa);
+    byte_string_clear(bs);
+    byte_string_clear(bs2);
+
+    if (IBE_setup(params2, m2, mont_maxbits + 8, 160, "test")) {
+	printf("BUG! setup accepted a huge p!\n");
+	params_clear(params2);
+	byte_string_clear(m2);
+	result = 0;
+    }
+
+    return result;
+}
+
+static int batch_inv_check(fp2_t *x, fp2_t *a, int n, mpz_t p)
+//x[i] = 1 / a[i] for each i, or 0 if a[i] = 0?
+{
+    fp2_t t;
+    int i;
+    int result = 1;
+
+    fp2_init(t);
+    for (i=0; i<n; i++) {
+	if (fp2_is_0(a[i])) {
+	    if (!fp2_is_0(x[i])) result = 0;
+	} else {
+	    fp2_inv(t, a[i], p);
+	    if (!fp2_equal(t, x[i])) result = 0;
+	}
+    }
+    fp2_clear(t);
+    return result;
+}
+
+static int batch_inv_test(params_t params, byte_string_t master)
+{
+    enum { n = 7 };
+    fp2_t a[n], x[n], c[n];
+    mpz_t za[n], zx[n];
+    fp2m_t am[n], xm[n];
+    mpz_ptr p = params->p;
+    mont_ptr m = params->curve->mont;
+    int i, ok;
+    int result = 1;
+
+    //entries 0 and 3 are zero, entry 5 lies in F_p
+    for (i=0; i<n; i++) {
+	fp2_init(a[i]);
+	fp2_init(x[i]);
+	fp2_init(c[i]);
+	fp2_random(a[i], p);
+	mpz_init(za[i]);
+	mpz_init(zx[i]);
+    }
+    fp2_set_0(a[0]);
+    fp2_set_0(a[3]);
+    mpz_set_ui(a[5]->b, 0);
+
+    fp2_batch_inv(x, a, n, p);
+    if (!batch_inv_check(x, a, n, p)) {
+	printf("BUG! fp2_batch_inv is broken!\n");
+	result = 0;
+    }
+    for (i=0; i<n; i++) fp2_set(x[i], a[i]);
+    fp2_batch_inv(x, x, n, p);
+    if (!batch_inv_check(x, a, n, p)) {
+	printf("BUG! fp2_batch_inv in place is broken!\n");
+	result = 0;
+    }
+
+    //the real parts alone
+    for (i=0; i<n; i++) {
+	mpz_set(za[i], a[i]->a);
+	mpz_set(c[i]->a, a[i]->a);
+	mpz_set_ui(c[i]->b, 0);
+    }
+    fp_batch_inv(zx, za, n, p);
+    fp_batch_inv(za, za, n, p);
+    ok = 1;
+    for (i=0; i<n; i++) {
+	mpz_set(x[i]->a, zx[i]);
+	mpz_set_ui(x[i]->b, 0);
+	if (mpz_cmp(za[i], zx[i])) ok = 0;
+    }
+    if (!ok || !batch_inv_check(x, c, n, p)) {
+	printf("BUG! fp_batch_inv is broken!\n");
+	result = 0;
+    }
+
+    //Montgomery form
+    for (i=0; i<n; i++) {
+	fp2m_set_fp2(am[i], a[i], m);
+    }
+    fp2m_batch_inv(xm[0], am[0], n, m);
+    for (i=0; i<n; i++) {
+	fp2m_get_fp2(x[i], xm[i], m);
+    }
+    if (!batch_inv_check(x, a, n, p)) {
+	printf("BUG! fp2m_batch_inv is broken!\n");
+	result = 0;
+    }
+    fp2m_batch_inv(am[0], am[0], n, m);
+    for (i=0; i<n; i++) {
+	fp2m_get_fp2(x[i], am[i], m);
+    }
+    if (!batch_inv_check(x, a, n, p)) {
+	printf("BUG! fp2m_batch_inv in place is broken!\n");
+	result = 0;
+    }
+    for (i=0; i<n; i++) {
+	fp2m_set_fp2(am[i], a[i], m);
+	fp2m_inv(xm[i], am[i], m);
+	fp2m_get_fp2(x[i], xm[i], m);
+    }
+    if (!batch_inv_check(x, a, n, p)) {
+	printf("BUG! fp2m_inv is broken!\n");
+	result = 0;
+    }
+
+    for (i=0; i<n; i++) {
+	fp2_clear(a[i]);
+	fp2_clear(x[i]);
+	fp2_clear(c[i]);
+	mpz_clear(za[i]);
+	mpz_clear(zx[i]);
+    }
+    return result;
+}
+
+static int multi_mul_test(params_t params, byte_string_t master)
+//point_multi_mul against a sum of point_mul results, for few terms
+//(Straus) and many (Pippenger)
+{
+    enum { count = 150 };
+    int size[2] = { 7, count };
+    mpz_t n[count], r;
+    point_t P[count], R, S, T;
+    point_ptr Pp[count];
+    int i, j;
+    int result = 1;
+
+    mpz_init(r);
+    point_init(R);
+    point_init(S);
+    point_init(T);
+    for (i=0; i<count; i++) {
+	mpz_init(n[i]);
+	point_init(P[i]);
+	Pp[i] = P[i];
+	mympz_randomm(r, params->q);
+	mpz_add_ui(r, r, 1);
+	point_mul_postprocess(P[i], r, params->P_fb, params->curve);
+	//scalars lie in (-q, q), and a few are 0 or 1
+	mympz_randomm(n[i], params->q);
+	if (i % 3 == 1) mpz_neg(n[i], n[i]);
+    }
+    mpz_set_ui(n[2], 0);
+    mpz_set_ui(n[4], 1);
+    mpz_set_ui(n[count - 1], 0);
+    point_set_O(P[5]);
+
+    for (j=0; j<2; j++) {
+	point_multi_mul(R, n, Pp, size[j], params->curve);
+
+	point_set_O(S);
+	for (i=0; i<size[j]; i++) {
+	    if (!mpz_sgn(n[i])) continue;
+	    mpz_abs(r, n[i]);
+	    point_mul(T, r, P[i], params->curve);
+	    if (mpz_sgn(n[i]) < 0 && !T->infinity) {
+		mpz_sub(T->y->a, params->p, T->y->a);
+	    }
+	    point_add(S, S, T, params->curve);
+	}
+	if (R->infinity != S->infinity || !point_equal(R, S)) {
+	    printf("BUG! point_multi_mul failed for %d terms!\n", size[j]);
+	    result = 0;
+	}
+    }
+
+    for (i=0; i<count; i++) {
+	mpz_clear(n[i]);
+	point_clear(P[i]);
+    }
+    point_clear(R);
+    point_clear(S);
+    point_clear(T);
+    mpz_clear(r);
+    return result;
+}
+
+static int mul_array_test(params_t params, byte_string_t master)
+//point_mul_array against point_mul on each point, over several chunks
+{
+    enum { count = 133 };
+    mpz_t n, r;
+    point_t P[count], R[count], S;
+    point_ptr Pp[count], Rp[count];
+    int i, j;
+    int result = 1;
+
+    mpz_init(n);
+    mpz_init(r);
+    point_init(S);
+    for (i=0; i<count; i++) {
+	point_init(P[i]);
+	point_init(R[i]);
+	Pp[i] = P[i];
+	Rp[i] = R[i];
+	mympz_randomm(r, params->q);
+	mpz_add_ui(r, r, 1);
+	point_mul_postprocess(P[i], r, params->P_fb, params->curve);
+    }
+    point_set_O(P[3]);
+    point_set_O(P[count - 1]);
+
+    //n = 1, then a random n, then a random n in place
+    for (j=0; j<3; j++) {
+	if (j) {
+	    mympz_randomm(n, params->q);
+	    mpz_add_ui(n, n, 1);
+	} else mpz_set_ui(n, 1);
+	if (j < 2) {
+	    point_mul_array(Rp, n, Pp, count, params->curve);
+	} else {
+	    for (i=0; i<count; i++) point_set(R[i], P[i]);
+	    point_mul_array(Rp, n, Rp, count, params->curve);
+	}
+	for (i=0; i<count; i++) {
+	    if (P[i]->infinity) point_set_O(S);
+	    else point_mul(S, n, P[i], params->curve);
+	    if (S->infinity != R[i]->infinity || !point_equal(S, R[i])) {
+		printf("BUG! point_mul_array failed!\n");
+		result = 0;
+	    }
+	}
+    }
+
+    for (i=0; i<count; i++) {
+	point_clear(P[i]);
+	point_clear(R[i]);
+    }
+    point_clear(S);
+    mpz_clear(n);
+    mpz_clear(r);
     return result;
 }
 
@@ -350,6 +804,162 @@ static int key_test(params_t params, byte_string_t master)
     return result;
 }
 
+static int preprocess_test(params_t params, byte_string_t master)
+{
+    char id[1024];
+    int i;
+    byte_string_t U, V;
+    byte_string_t key, bs;
+    byte_string_t K, K2;
+    preprocessed_key_t pk, pk2;
+    int result = 1;
+
+    random_charstar(id, 1024);
+
+    IBE_extract(key, master, id, params);
+    preprocessed_key_init(pk, params);
+    preprocessed_key_init(pk2, params);
+    IBE_preprocess_key(pk, key, params);
+
+    //a preprocessed key should survive a round trip through a byte_string
+    IBE_serialize_preprocessed_key(bs, pk, params);
+    if (1 != IBE_deserialize_preprocessed_key(pk2, bs, params)) {
+	printf("BUG! deserialize_preprocessed_key failed!\n");
+	result = 0;
+    }
+    byte_string_clear(bs);
+
+    for (i=0; i<4; i++) {
+	IBE_KEM_encrypt(K, U, id, params);
+	IBE_KEM_decrypt_preprocessed(K2, U, pk2, params);
+	byte_string_clear(U);
+	if (byte_string_cmp(K, K2)) {
+	    printf("BUG! preprocessed KEM is broken!\n");
+	    result = 0;
+	}
+	byte_string_clear(K);
+	byte_string_clear(K2);
+
+	crypto_generate_key(K);
+	IBE_hide_key(U, V, id, K, params);
+	if (1 != IBE_reveal_key_preprocessed(K2, U, V, pk, params)) {
+	    printf("BUG! reveal_key_preprocessed failed!\n");
+	    result = 0;
+	} else {
+	    if (byte_string_cmp(K, K2)) {
+		printf("BUG! key mismatch!\n");
+		result = 0;
+	    }
+	    byte_string_clear(K2);
+	}
+	byte_string_clear(K);
+	byte_string_clear(U);
+	byte_string_clear(V);
+    }
+
+    preprocessed_key_clear(pk);
+    preprocessed_key_clear(pk2);
+    byte_string_clear(key);
+
+    return result;
+}
+
+static int cache_test(params_t params, byte_string_t master)
+{
+    char id[4][64];
+    int i, j;
+    byte_string_t U;
+    byte_string_t key[4];
+    byte_string_t K, K2;
+    unsigned long hits, hits2, gidhits, gidhits2;
+    byte_string_t priv, pub, cert, sig, message;
+    char s[64];
+    int result = 1;
+
+    lru_stats(params->idcache, &hits, NULL, NULL, NULL, NULL);
+    lru_stats(params->gidcache, &gidhits, NULL, NULL, NULL, NULL);
+
+    for (i=0; i<4; i++) {
+	random_charstar(id[i], 64);
+	IBE_extract(key[i], master, id[i], params);
+    }
+    //encrypting to the same IDs again should hit the caches
+    //and give the same answers
+    //(the third time round uses fixed-base tables)
+    for (j=0; j<3; j++) {
+	for (i=0; i<4; i++) {
+	    IBE_KEM_encrypt(K, U, id[i], params);
+	    IBE_KEM_decrypt(K2, U, key[i], params);
+	    if (byte_string_cmp(K, K2)) {
+		printf("BUG! cached ID gives wrong secret!\n");
+		result = 0;
+	    }
+	    byte_string_clear(U);
+	    byte_string_clear(K);
+	    byte_string_clear(K2);
+	}
+    }
+
+    lru_stats(params->idcache, &hits2, NULL, NULL, NULL, NULL);
+    lru_stats(params->gidcache, &gidhits2, NULL, NULL, NULL, NULL);
+    if (hits2 < hits + 4 || gidhits2 < gidhits + 8) {
+	printf("BUG! cache missed!\n");
+	result = 0;
+    }
+
+    //verifying several messages from one signer
+    //should compute the certificate pairing once
+    lru_stats(params->certcache, &hits, NULL, NULL, NULL, NULL);
+    IBE_keygen(priv, pub, params);
+    IBE_certify(cert, master, pub, id[0], params);
+    for (i=0; i<3; i++) {
+	random_charstar(s, 64);
+	byte_string_set(message, s);
+	IBE_sign(sig, message, priv, cert, params);
+	if (!IBE_verify(sig, message, pub, id[0], params)) {
+	    printf("BUG! signature with cached certificate failed!\n");
+	    result = 0;
+	}
+	if (IBE_verify(sig, message, pub, id[1], params)) {
+	    printf("BUG! signature verified with wrong ID!\n");
+	    result = 0;
+	}
+	byte_string_clear(message);
+	byte_string_clear(sig);
+    }
+    lru_stats(params->certcache, &hits2, NULL, NULL, NULL, NULL);
+    if (hits2 < hits + 2) {
+	printf("BUG! certificate cache missed!\n");
+	result = 0;
+    }
+    byte_string_clear(cert);
+
+    //the same for BLS signatures: from the third on,
+    //the public key has been preprocessed
+    for (i=0; i<4; i++) {
+	random_charstar(s, 64);
+	byte_string_set(message, s);
+	BLS_sign(sig, message, priv, params);
+	if (!BLS_verify(sig, message, pub, params)) {
+	    printf("BUG! signature with cached public key failed!\n");
+	    result = 0;
+	}
+	byte_string_clear(message);
+	byte_string_set(message, "wrong message");
+	if (BLS_verify(sig, message, pub, params)) {
+	    printf("BUG! cached public key verified wrong message!\n");
+	    result = 0;
+	}
+	byte_string_clear(message);
+	byte_string_clear(sig);
+    }
+    byte_string_clear(priv);
+    byte_string_clear(pub);
+
+    for (i=0; i<4; i++) byte_string_clear(key[i]);
+    return result;
+}
+
 static void single_system_torture(int test_no)
 {
     params_t params;
@@ -436,6 +1046,7 @@ static void *thread_function(void *arg)
 	params_clear(params);
     }
 
+    IBE_thread_clear();
     return NULL;
 }
 
@@ -484,6 +1095,15 @@ static void init_torture_table()
     register_test(test_split, "split", split_test);
     register_test(test_combine, "combine", combine_test);
     register_test(test_crypto, "crypto", crypto_test);
+    register_test(test_preprocess, "preprocess", preprocess_test);
+    register_test(test_cache, "cache", cache_test);
+    register_test(test_bls_batch, "BLS batch", bls_batch_test);
+    register_test(test_bls_aggregate, "BLS aggregate", bls_aggregate_test);
+    register_test(test_extract_batch, "extract batch", extract_batch_test);
+    register_test(test_params, "params", params_test);
+    register_test(test_batch_inv, "batch inverse", batch_inv_test);
+    register_test(test_multi_mul, "multi mul", multi_mul_test);
+    register_test(test_mul_array, "mul array", mul_array_test);
     register_test(test_random, "random", random_test);
 
     register_metatest(metatest_single, "single", single_system_torture);